@@ -0,0 +1,219 @@
+// host side benchmark for the forecast parser
+//
+// replays open-meteo responses through the same WeatherForecast/tempMatcher
+// classes the device uses and reports throughput, stack and heap use per fetch
+//
+// build and run over the responses in fixtures/ (from this directory,
+// LIBS = your Arduino libraries folder):
+//   make LIBS=~/Arduino/libraries run
+//
+// or by hand:
+//   ./forecast_bench [-n iterations] [recorded.json ...]
+// with no files a synthetic corpus shaped like open-meteo output is used
+// (forecast_days 1, 2, 7 and 16, four hourly variables)
+//
+// fixtures/ holds a 2 and a 16 day response for the url in the Makefile,
+// "make capture" replaces them with fresh ones
+#include <Arduino.h>
+#include <ArduinoStreamParser.h>
+#include "forecastparser.h"
+#include <chrono>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+extern "C" {
+void * __libc_malloc(size_t);
+void * __libc_calloc(size_t, size_t);
+void * __libc_realloc(void *, size_t);
+void __libc_free(void *);
+}
+
+// heap and stack accounting, only active while a fetch is being replayed
+static bool counting = false;
+static size_t allocs = 0;
+static size_t alloc_bytes = 0;
+static uintptr_t stack_base = 0;
+static uintptr_t stack_low = 0;
+
+static inline void probe_stack() {
+    char probe;
+    uintptr_t sp = (uintptr_t)&probe;
+    if (counting && sp < stack_low) {
+        stack_low = sp;
+    }
+}
+
+extern "C" {
+void * malloc(size_t n) {
+    if (counting) { ++allocs; alloc_bytes += n; probe_stack(); }
+    return __libc_malloc(n);
+}
+void * calloc(size_t n, size_t m) {
+    if (counting) { ++allocs; alloc_bytes += n * m; probe_stack(); }
+    return __libc_calloc(n, m);
+}
+void * realloc(void * p, size_t n) {
+    if (counting) { ++allocs; alloc_bytes += n; probe_stack(); }
+    return __libc_realloc(p, n);
+}
+void free(void * p) {
+    __libc_free(p);
+}
+}
+
+// samples the stack on every callback the parser makes
+class ProbedForecast : public WeatherForecast {
+    public:
+        ProbedForecast(forecastVar * v, int n, int loc, time_t t) :
+            WeatherForecast(v, n, loc, t) {}
+        virtual void startArray(ElementPath path) { probe_stack(); WeatherForecast::startArray(path); }
+        virtual void endArray(ElementPath path) { probe_stack(); WeatherForecast::endArray(path); }
+        virtual void value(ElementPath path, ElementValue value) { probe_stack(); WeatherForecast::value(path, value); }
+};
+
+struct payload {
+    std::string name;
+    std::string body;
+    time_t now;
+};
+
+// same shape as the device defaults plus the kind of extra variables
+// configured through fcstvar.N
+static const int nvars = 5;
+static void setup_vars(forecastVar * vars) {
+    const struct { const char * label; const char * variable; int from, to; fcstReducer r; } defs[nvars] = {
+        { "low", "temperature_2m", 0, 12, FR_MIN },
+        { "histlow", "temperature_2m", -6, 0, FR_MIN },
+        { "wind", "wind_speed_10m", 0, 12, FR_MAX },
+        { "rain", "precipitation_probability", 0, 24, FR_MAX },
+        { "solar", "shortwave_radiation", 0, 24, FR_SUM },
+    };
+    for (int i = 0; i < nvars; ++i) {
+        vars[i].label = defs[i].label;
+        vars[i].variable = defs[i].variable;
+        vars[i].location = 0;
+        vars[i].from = defs[i].from;
+        vars[i].to = defs[i].to;
+        vars[i].matcher.setReducer(defs[i].r);
+        vars[i].valid = false;
+    }
+}
+
+static payload synthesise(int forecast_days) {
+    const time_t start = 1700000000 - (1700000000 % 86400) - 86400; // past_days=1
+    const int hours = (forecast_days + 1) * 24;
+    std::ostringstream o;
+    o << "{\"latitude\":50.5,\"longitude\":-1.0,\"generationtime_ms\":0.1,"
+      << "\"utc_offset_seconds\":0,\"timezone\":\"GMT\",\"timezone_abbreviation\":\"GMT\",\"elevation\":10.0,"
+      << "\"hourly_units\":{\"time\":\"unixtime\",\"temperature_2m\":\"°C\",\"wind_speed_10m\":\"km/h\","
+      << "\"precipitation_probability\":\"%\",\"shortwave_radiation\":\"W/m²\"},\"hourly\":{";
+    const char * names[] = { "time", "temperature_2m", "wind_speed_10m", "precipitation_probability", "shortwave_radiation" };
+    for (int v = 0; v < 5; ++v) {
+        o << (v ? "," : "") << "\"" << names[v] << "\":[";
+        for (int h = 0; h < hours; ++h) {
+            if (h) { o << ","; }
+            switch (v) {
+                case 0: o << (start + h * 3600); break;
+                case 1: o << (8.0 + 6.0 * sin(h * M_PI / 12.0)); break;
+                case 2: o << (12.5 + (h * 7) % 20); break;
+                case 3: o << ((h * 13) % 100); break;
+                case 4: o << ((h % 24 > 6 && h % 24 < 18) ? 300.0 + h % 50 : 0.0); break;
+            }
+        }
+        o << "]";
+    }
+    o << "}}";
+    payload p;
+    p.name = "synthetic forecast_days=" + std::to_string(forecast_days);
+    p.body = o.str();
+    p.now = start + 36 * 3600;
+    return p;
+}
+
+// use the time in the middle of the recorded hourly.time array as "now"
+static time_t guess_now(const std::string & body) {
+    size_t t = body.find("\"time\":[");
+    if (t == std::string::npos) {
+        return time(NULL);
+    }
+    t += 8;
+    size_t e = body.find(']', t);
+    time_t first = atol(body.c_str() + t);
+    size_t last_comma = body.rfind(',', e);
+    time_t last = (last_comma != std::string::npos && last_comma > t) ? atol(body.c_str() + last_comma + 1) : first;
+    return first + (last - first) / 2;
+}
+
+int main(int argc, char ** argv) {
+    int iterations = 200;
+    std::vector<payload> corpus;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && (i + 1) < argc) {
+            iterations = atoi(argv[++i]);
+            continue;
+        }
+        std::ifstream f(argv[i], std::ios::binary);
+        if (!f) {
+            fprintf(stderr, "cannot read %s\n", argv[i]);
+            return 1;
+        }
+        std::ostringstream o;
+        o << f.rdbuf();
+        payload p;
+        p.name = argv[i];
+        p.body = o.str();
+        p.now = guess_now(p.body);
+        corpus.push_back(p);
+    }
+    if (corpus.empty()) {
+        for (int d : { 1, 2, 7, 16 }) {
+            corpus.push_back(synthesise(d));
+        }
+    }
+
+    printf("%-40s %9s %10s %9s %8s %10s  %s\n", "payload", "bytes", "MB/s", "stack", "allocs", "alloc B", "values");
+    for (const payload & p : corpus) {
+        forecastVar vars[nvars];
+        double best = 1e30;
+        size_t fetch_allocs = 0, fetch_bytes = 0, stack_depth = 0;
+        bool ok = false;
+        for (int it = 0; it < iterations; ++it) {
+            setup_vars(vars);
+            char base;
+            stack_base = stack_low = (uintptr_t)&base;
+            allocs = alloc_bytes = 0;
+            counting = true;
+            auto t0 = std::chrono::steady_clock::now();
+            {
+                ArudinoStreamParser parser;
+                ProbedForecast handler(vars, nvars, 0, p.now);
+                parser.setHandler(&handler);
+                // same path as HTTPClient::writeToStream
+                Print & out = parser;
+                out.write((const uint8_t *)p.body.data(), p.body.size());
+                ok = handler.status();
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            counting = false;
+            double secs = std::chrono::duration<double>(t1 - t0).count();
+            if (secs < best) { best = secs; }
+            fetch_allocs = allocs;
+            fetch_bytes = alloc_bytes;
+            if (stack_base - stack_low > stack_depth) { stack_depth = stack_base - stack_low; }
+        }
+        printf("%-40.40s %9zu %10.2f %9zu %8zu %10zu ", p.name.c_str(), p.body.size(),
+               p.body.size() / best / 1e6, stack_depth, fetch_allocs, fetch_bytes);
+        if (!ok) {
+            printf(" no values!\n");
+            continue;
+        }
+        for (int i = 0; i < nvars; ++i) {
+            if (vars[i].valid) {
+                printf(" %s=%.1f", vars[i].label.c_str(), vars[i].value);
+            }
+        }
+        printf("\n");
+    }
+    return 0;
+}
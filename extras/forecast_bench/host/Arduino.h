@@ -0,0 +1,72 @@
+// just enough of the Arduino core to build the forecast parser on a host
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <string>
+
+class String {
+    public:
+        String() {}
+        String(const char * c) { if (c) { s = c; } }
+        String(const std::string & x) : s(x) {}
+        explicit String(char c) : s(1, c) {}
+        String(int v) : s(std::to_string(v)) {}
+        String(long v) : s(std::to_string(v)) {}
+        String(unsigned int v) : s(std::to_string(v)) {}
+        String(unsigned long v) : s(std::to_string(v)) {}
+        String(float v) : s(std::to_string(v)) {}
+        String(double v) : s(std::to_string(v)) {}
+        const char * c_str() const { return s.c_str(); }
+        unsigned int length() const { return s.size(); }
+        bool isEmpty() const { return s.empty(); }
+        char charAt(unsigned int i) const { return s[i]; }
+        char operator[](unsigned int i) const { return s[i]; }
+        char & operator[](unsigned int i) { return s[i]; }
+        String & operator+=(const String & o) { s += o.s; return *this; }
+        String & operator+=(const char * o) { s += o; return *this; }
+        String & operator+=(char c) { s += c; return *this; }
+        bool concat(char c) { s += c; return true; }
+        bool concat(const char * c) { s += c; return true; }
+        bool operator==(const String & o) const { return s == o.s; }
+        bool operator==(const char * o) const { return s == o; }
+        bool operator!=(const String & o) const { return s != o.s; }
+        bool operator!=(const char * o) const { return s != o; }
+        int indexOf(char c, unsigned int from = 0) const { return pos(s.find(c, from)); }
+        int indexOf(const String & c, unsigned int from = 0) const { return pos(s.find(c.s, from)); }
+        String substring(unsigned int a) const { return String(s.substr(a)); }
+        String substring(unsigned int a, unsigned int b) const { return String(s.substr(a, b - a)); }
+        bool startsWith(const String & p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+        long toInt() const { return atol(s.c_str()); }
+        float toFloat() const { return atof(s.c_str()); }
+        void clear() { s.clear(); }
+    private:
+        static int pos(size_t p) { return (p == std::string::npos) ? -1 : (int)p; }
+        std::string s;
+};
+inline String operator+(const String & a, const String & b) { String r(a); r += b; return r; }
+inline String operator+(const String & a, const char * b) { String r(a); r += b; return r; }
+inline String operator+(const char * a, const String & b) { String r(a); r += b; return r; }
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t) = 0;
+        virtual size_t write(const uint8_t * b, size_t n) {
+            size_t i = 0;
+            while (i < n && write(b[i])) { ++i; }
+            return i;
+        }
+        virtual void flush() {}
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() { return 0; }
+        virtual int read() { return -1; }
+        virtual int peek() { return -1; }
+};
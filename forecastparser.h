@@ -0,0 +1,177 @@
+// open-meteo forecast parsing
+// kept free of networking and config so that it can also be built off
+// device (see extras/forecast_bench)
+#pragma once
+#include <Arduino.h>
+#include "JsonHandler.h"
+
+enum fcstReducer { FR_MIN, FR_MAX, FR_MEAN, FR_SUM };
+
+// accumulates the values whose timestamps fall within a window
+// relies on open-meteo sending hourly.time before the value arrays
+class tempMatcher {
+    private:
+        int min_index = -1;
+        int max_index = -1;
+        float acc = 0.0;
+        int count = 0;
+        time_t earliest = 0;
+        time_t latest = 0;
+        fcstReducer reducer = FR_MIN;
+    public:
+        tempMatcher() {}
+        void setReducer(fcstReducer r) { reducer = r; }
+        void reset(time_t from, time_t to) {
+            earliest = from;
+            latest = to;
+            min_index = -1;
+            max_index = -1;
+            acc = 0.0;
+            count = 0;
+        }
+        bool getValue(float &value) {
+            // do not persist the value we calculated if we
+            // didn't actually see anything
+            if (count == 0) {
+                return false;
+            }
+            value = (reducer == FR_MEAN) ? (acc / count) : acc;
+            return true;
+        }
+        bool getTemp(int &temp) {
+            float v;
+            if (getValue(v)) {
+                temp = round(v);
+                return true;
+            }
+            return false;
+        }
+        void processTime(int i, time_t x) {
+            if ((x >= earliest) && (min_index == -1)) {
+                min_index = i;
+            }
+            if (x <= latest) {
+                max_index = i;
+            }
+        }
+        void processValue(int i, float x) {
+            if ((min_index == -1) || (i < min_index) || (i > max_index)) {
+                return;
+            }
+            if (count == 0) {
+                acc = x;
+            } else {
+                switch (reducer) {
+                    case FR_MIN: if (x < acc) { acc = x; } break;
+                    case FR_MAX: if (x > acc) { acc = x; } break;
+                    case FR_MEAN:
+                    case FR_SUM: acc += x; break;
+                }
+            }
+            ++count;
+        }
+};
+
+// one (location, variable, window, reducer) to be extracted from the forecast
+struct forecastVar {
+    String label;
+    int location = 0;
+    String variable;
+    int from = 0; // hours relative to now
+    int to = 0;
+    tempMatcher matcher;
+    float value = 0.0;
+    bool valid = false;
+};
+
+class WeatherForecast: public JsonHandler {
+
+    private:
+        forecastVar * vars;
+        int nvars;
+        int location;
+        bool in_times = false;
+        // bitmask of vars fed by the current array
+        uint32_t in_vars = 0;
+        bool finished = false;
+        time_t now = 0;
+
+    public:
+        WeatherForecast(forecastVar * v, int n, int loc, time_t t) :
+            vars(v), nvars(n), location(loc), now(t) {}
+
+        virtual void startDocument() {
+            for (int i = 0; i < nvars; ++i) {
+                forecastVar & v = vars[i];
+                if (v.location == location && !v.variable.isEmpty()) {
+                    v.matcher.reset(now + (v.from*3600), now + (v.to*3600));
+                }
+            }
+        };
+
+        virtual void startArray(ElementPath path) {
+            char fullPath[200] = "";	
+            path.toString(fullPath);
+            if (strncmp(fullPath,"hourly.",7) != 0) {
+                return;
+            }
+            if (strcmp(fullPath+7,"time") == 0) {
+                in_times = true;
+                return;
+            }
+            for (int i = 0; i < nvars; ++i) {
+                if ((vars[i].location == location) &&
+                    (vars[i].variable == (fullPath+7))) {
+                    in_vars |= (1UL << i);
+                }
+            }
+        };
+
+        virtual void startObject(ElementPath path) { };
+
+        virtual void endArray(ElementPath path) {
+            in_times = false;
+            in_vars = 0;
+        };
+
+        virtual void endObject(ElementPath path) { };
+
+        virtual void endDocument() {
+            finished = false;
+            for (int i = 0; i < nvars; ++i) {
+                forecastVar & v = vars[i];
+                if (v.location != location || v.variable.isEmpty()) {
+                    continue;
+                }
+                v.valid = v.matcher.getValue(v.value);
+                finished |= v.valid;
+            }
+        };
+
+        // true if any variable for this location got a value
+        bool status() const {
+            return finished;
+        }
+
+        virtual void value(ElementPath path, ElementValue value) {
+            if (in_times) {
+                int i = path.getIndex();
+                time_t x = value.getInt();
+                for (int j = 0; j < nvars; ++j) {
+                    if (vars[j].location == location) {
+                        vars[j].matcher.processTime(i,x);
+                    }
+                }
+            } else if (in_vars) {
+                int i = path.getIndex();
+                float x = value.getFloat();
+                for (int j = 0; j < nvars; ++j) {
+                    if (in_vars & (1UL << j)) {
+                        vars[j].matcher.processValue(i,x);
+                    }
+                }
+            }
+        };
+
+        virtual void whitespace(char c) {};
+};
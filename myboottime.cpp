@@ -0,0 +1,177 @@
+// boot phase timing
+#include <Arduino.h>
+#include <myboottime.h>
+#include <mysyslog.h>
+#include <Ticker.h>
+#ifndef ESP8266
+#include <esp_timer.h>
+#endif
+
+#ifndef BOOT_MAX_PHASES
+#define BOOT_MAX_PHASES 16
+#endif
+// seconds after network up before the report goes to syslog
+#ifndef BOOT_REPORT_DELAY
+#define BOOT_REPORT_DELAY 30
+#endif
+#define BOOT_MAGIC 0xb0071e55
+
+struct bootPhase {
+    char name[12];
+    // microseconds since reset, end == 0 while the phase is running
+    uint32_t start;
+    uint32_t end;
+};
+struct bootRecord {
+    uint32_t magic;
+    uint32_t count;
+    bootPhase phases[BOOT_MAX_PHASES];
+};
+
+// survives a reset so the previous boot can still be inspected
+#ifdef ESP8266
+// plain memory, the previous boot is never available here
+static bootRecord boot_rec;
+#else
+RTC_NOINIT_ATTR static bootRecord boot_rec;
+#endif
+static bootRecord last_boot;
+static bool started = false;
+static bool reported = false;
+static Ticker boot_report_ticker;
+// phases are begun and ended from several tasks and the wifi event task
+#ifdef ESP8266
+#define BOOT_LOCK()
+#define BOOT_UNLOCK()
+#else
+static portMUX_TYPE boot_mux = portMUX_INITIALIZER_UNLOCKED;
+#define BOOT_LOCK() portENTER_CRITICAL(&boot_mux)
+#define BOOT_UNLOCK() portEXIT_CRITICAL(&boot_mux)
+#endif
+
+static uint32_t now_us() {
+#ifdef ESP8266
+    return (uint32_t)micros64();
+#else
+    return (uint32_t)esp_timer_get_time();
+#endif
+}
+
+// called with the lock held
+static void boot_start() {
+    if (started) { return; }
+    started = true;
+    if ((boot_rec.magic == BOOT_MAGIC) && (boot_rec.count <= BOOT_MAX_PHASES)) {
+        last_boot = boot_rec;
+    } else {
+        last_boot.count = 0;
+    }
+    boot_rec.magic = BOOT_MAGIC;
+    boot_rec.count = 0;
+}
+
+static int boot_add(const char * name, uint32_t start, uint32_t end) {
+    int ret = -1;
+    BOOT_LOCK();
+    boot_start();
+    if (boot_rec.count < BOOT_MAX_PHASES) {
+        bootPhase & p = boot_rec.phases[boot_rec.count];
+        strncpy(p.name, name, sizeof(p.name) - 1);
+        p.name[sizeof(p.name) - 1] = 0;
+        p.start = start;
+        p.end = end;
+        ret = boot_rec.count++;
+    }
+    BOOT_UNLOCK();
+    return ret;
+}
+
+int BOOT_begin(const char * name) {
+    return boot_add(name, now_us(), 0);
+}
+
+void BOOT_end(int phase) {
+    uint32_t t = now_us();
+    BOOT_LOCK();
+    if ((phase >= 0) && (phase < (int)boot_rec.count)) {
+        boot_rec.phases[phase].end = t;
+    }
+    BOOT_UNLOCK();
+}
+
+void BOOT_mark(const char * name) {
+    // same start and end, shown without a duration
+    uint32_t t = now_us();
+    boot_add(name, t, t);
+}
+
+// copy under the lock, describing it allocates
+static void snapshot(bootRecord & r) {
+    BOOT_LOCK();
+    r.count = boot_rec.count;
+    memcpy(r.phases, boot_rec.phases, sizeof(r.phases[0]) * r.count);
+    BOOT_UNLOCK();
+}
+
+static void describe_phase(char * b, size_t len, const bootPhase & p) {
+    if (p.end == 0) {
+        snprintf(b, len, "%s @%ums running", p.name, (unsigned)(p.start / 1000));
+    } else if (p.end == p.start) {
+        snprintf(b, len, "%s @%ums", p.name, (unsigned)(p.start / 1000));
+    } else {
+        snprintf(b, len, "%s @%ums %ums", p.name,
+                 (unsigned)(p.start / 1000), (unsigned)((p.end - p.start) / 1000));
+    }
+}
+
+static void describe(String & out, const bootRecord & r, const char * sep) {
+    char b[48];
+    for (uint32_t i = 0; i < r.count; ++i) {
+        describe_phase(b, sizeof(b), r.phases[i]);
+        if (i) { out += sep; }
+        out += b;
+    }
+}
+
+// several phases to a message, each kept well short of the syslog limit
+#define BOOT_REPORT_LINE 120
+static void boot_report() {
+    bootRecord r;
+    snapshot(r);
+    String x;
+    char b[48];
+    for (uint32_t i = 0; i < r.count; ++i) {
+        describe_phase(b, sizeof(b), r.phases[i]);
+        if (!x.isEmpty() && (x.length() + strlen(b) + 2 > BOOT_REPORT_LINE)) {
+            LOGF(LOGM_SYS, LOG_INFO, "%s", x.c_str());
+            x = String();
+        }
+        x += x.isEmpty() ? "boot phases: " : ", ";
+        x += b;
+    }
+    if (!x.isEmpty()) {
+        LOGF(LOGM_SYS, LOG_INFO, "%s", x.c_str());
+    }
+}
+
+void BOOT_network_up() {
+    BOOT_LOCK();
+    bool was = reported;
+    reported = true;
+    BOOT_UNLOCK();
+    if (was) { return; }
+    BOOT_mark("net.up");
+    boot_report_ticker.once(BOOT_REPORT_DELAY, boot_report);
+}
+
+void BOOT_status(String & out) {
+    bootRecord r;
+    snapshot(r);
+    out += "\n\nBoot phases:\n";
+    describe(out, r, "\n");
+    if (last_boot.count > 0) {
+        out += "\n\nPrevious boot phases:\n";
+        describe(out, last_boot, "\n");
+    }
+    out += "\n";
+}
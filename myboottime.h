@@ -0,0 +1,18 @@
+// boot phase timing
+// phases are timestamped against the high resolution timer, reported to
+// syslog once the network is up and shown in /status
+// ESP32 keeps them in RTC memory so /status also shows the previous boot,
+// ESP8266 has no room for them above eboot's area and only has this boot
+#pragma once
+#include <Arduino.h>
+
+// start a phase, returns a handle for BOOT_end or -1 if the table is full
+extern int BOOT_begin(const char * name);
+extern void BOOT_end(int phase);
+// a point in time rather than a phase
+extern void BOOT_mark(const char * name);
+// called when an IP address is first obtained, the breakdown is sent to
+// syslog a little later so the phases that follow are included
+extern void BOOT_network_up();
+// append the breakdown to a plain text status page
+extern void BOOT_status(String & out);
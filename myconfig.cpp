@@ -4,40 +4,252 @@
 #include <myconfig.h>
 #include <mywebserver.h>
 #include <Preferences.h>
-#include <map>
 #include <mysyslog.h>
 #include <mywifi.h>
+#include <mytrace.h>
+#include <myheap.h>
+#include <Ticker.h>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <ArduinoStreamParser.h>
+#include "JsonHandler.h"
+#ifdef ESP32
+// https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/storage/nvs_flash.html
+#include "nvs.h"
+#include "nvs_flash.h"
+#endif
 
 Preferences prefs;
+static String prefs_ns;
 
-std::map<String, MyCfgCbInt> config_int;
-std::map<String, MyCfgCbFloat> config_float;
-std::map<String, MyCfgCbString> config_string;
+// registered config names, kept sorted by name for binary search
+#ifndef MYCFG_MAX_NAMES
+#define MYCFG_MAX_NAMES 24
+#endif
+static MyCfgDesc registry[MYCFG_MAX_NAMES];
+static int registry_used = 0;
+
+// subscribers to committed changes, matched on a prefix of "name.id"
+#ifndef MYCFG_MAX_SUBSCRIBERS
+#define MYCFG_MAX_SUBSCRIBERS 16
+#endif
+struct cfg_subscriber {
+    const char * prefix;
+    MyCfgType type;
+    union {
+        MyCfgSubInt i;
+        MyCfgSubFloat f;
+        MyCfgSubString s;
+    } cb;
+};
+static cfg_subscriber subscribers[MYCFG_MAX_SUBSCRIBERS];
+static int subscribers_used = 0;
 bool redirectToRoot = false;
 
+// write-back cache of the values in our namespace
+// on ESP32 the whole namespace is loaded by MyCfgInit so a miss means the key
+// is not set, elsewhere (or if the cache overflows) misses are read through
+// writes are held until there has been no write for MYCFG_FLUSH_DELAY_MS or
+// MyCfgFlush is called
+#ifndef MYCFG_CACHE_SIZE
+#define MYCFG_CACHE_SIZE 64
+#endif
+#ifndef MYCFG_FLUSH_DELAY_MS
+#define MYCFG_FLUSH_DELAY_MS 2000
+#endif
+// NVS keys are limited to 15 characters
+#define MYCFG_KEY_LEN 16
+
+enum cfg_type : uint8_t { CFG_EMPTY, CFG_ABSENT, CFG_INT, CFG_FLOAT, CFG_STRING };
+struct cfg_entry {
+    char key[MYCFG_KEY_LEN];
+    cfg_type type;
+    bool dirty;
+    int32_t i;
+    float f;
+    String s;
+};
+static cfg_entry cache[MYCFG_CACHE_SIZE];
+static int cache_used = 0;
+static bool cache_complete = false;
+static Ticker flush_ticker;
+
 #ifdef ESP32
-// https://docs.espressif.com/projects/esp-idf/en/stable/esp32/api-reference/storage/nvs_flash.html
-#include "nvs.h"
-#include "nvs_flash.h"
-static void serve_config_list(AsyncWebServerRequest * request) {
-    String ls;
+// config is read from the TR/TF tasks and written from the web server
+static SemaphoreHandle_t cfg_mutex = NULL;
+#define CFG_LOCK() do { if (cfg_mutex) { xSemaphoreTakeRecursive(cfg_mutex, portMAX_DELAY); } ++cfg_depth; } while (0)
+#define CFG_UNLOCK() do { --cfg_depth; if (cfg_mutex) { xSemaphoreGiveRecursive(cfg_mutex); } } while (0)
+#else
+// single threaded, the depth is still needed to publish at the right time
+#define CFG_LOCK() ++cfg_depth
+#define CFG_UNLOCK() --cfg_depth
+#endif
+// how many times the holder has taken the lock
+static int cfg_depth = 0;
+// committed changes waiting for subscribers, who are only called once the
+// lock is fully released so they may read and write config themselves
+static std::vector<cfg_entry> unpublished;
+
+// build "name.id", false if too long to be an NVS key
+static bool cfg_key(char * buf, const char * name, const String & id) {
+    int l = snprintf(buf, MYCFG_KEY_LEN, "%s.%s", name, id.c_str());
+    if ((l < 0) || (l >= MYCFG_KEY_LEN)) {
+        LOGF(LOGM_CFG, LOG_ERR, "Config key %s.%s too long",name,id.c_str());
+        return false;
+    }
+    return true;
+}
+
+static uint32_t cfg_hash(const char * key) {
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    while (*key) {
+        h ^= (uint8_t)*key++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// find the slot holding key, or the empty slot where it would go
+// NULL if not present and the cache is full
+static cfg_entry * cache_slot(const char * key) {
+    uint32_t h = cfg_hash(key) % MYCFG_CACHE_SIZE;
+    for (int n = 0; n < MYCFG_CACHE_SIZE; ++n) {
+        cfg_entry * e = &cache[(h + n) % MYCFG_CACHE_SIZE];
+        if (e->type == CFG_EMPTY || strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static cfg_entry * cache_insert(const char * key) {
+    cfg_entry * e = cache_slot(key);
+    if (e == NULL) {
+        return NULL;
+    }
+    if (e->type == CFG_EMPTY) {
+        // keep one slot free so that probing always terminates
+        if (cache_used >= MYCFG_CACHE_SIZE - 1) {
+            cache_complete = false;
+            return NULL;
+        }
+        strcpy(e->key, key);
+        e->type = CFG_ABSENT;
+        e->dirty = false;
+        ++cache_used;
+    }
+    return e;
+}
+
+static void cache_clear() {
+    for (int i = 0; i < MYCFG_CACHE_SIZE; ++i) {
+        cache[i].type = CFG_EMPTY;
+        cache[i].dirty = false;
+        cache[i].s = String();
+    }
+    cache_used = 0;
+}
+
+// look up key expecting type t, reading through to NVS if the cache is not
+// authoritative, returns NULL if not set
+static cfg_entry * cache_get(const char * key, cfg_type t) {
+    cfg_entry * e = cache_slot(key);
+    if (e != NULL && e->type != CFG_EMPTY) {
+        return (e->type == t) ? e : NULL;
+    }
+    if (cache_complete) {
+        return NULL;
+    }
+    // read through
+    static cfg_entry direct;
+    e = cache_insert(key);
+    if (e == NULL) {
+        // cache full, answer directly from NVS
+        e = &direct;
+        strcpy(e->key, key);
+    }
+    e->type = CFG_ABSENT;
+    if (prefs.isKey(key)) {
+#ifdef ESP32
+        // cache what is really stored, asking for another type is a miss
+        // and must not hide the value from a later correctly typed get
+        switch (prefs.getType(key)) {
+            case PT_I32:
+                e->type = CFG_INT;
+                e->i = prefs.getInt(key, 0);
+                break;
+            case PT_STR:
+                e->type = CFG_STRING;
+                e->s = prefs.getString(key);
+                break;
+            case PT_BLOB:
+                // Preferences stores floats as 4 byte blobs
+                if (prefs.getBytesLength(key) == sizeof(float)) {
+                    e->type = CFG_FLOAT;
+                    e->f = prefs.getFloat(key, 0);
+                    break;
+                }
+                // fall through
+            default:
+                // not something we wrote, leave for read through
+                e->type = CFG_EMPTY;
+                if (e != &direct) {
+                    --cache_used;
+                }
+                return NULL;
+        }
+#else
+        // no type information, trust the caller
+        e->type = t;
+        switch (t) {
+            case CFG_INT: e->i = prefs.getInt(key, 0); break;
+            case CFG_FLOAT: e->f = prefs.getFloat(key, 0); break;
+            case CFG_STRING: e->s = prefs.getString(key); break;
+            default: break;
+        }
+#endif
+    }
+    return (e->type == t) ? e : NULL;
+}
+
+#ifdef ESP32
+// load every key in our namespace into the cache
+static void cache_load() {
     nvs_iterator_t it = NULL;
     esp_err_t res = ESP_OK;
+    cache_complete = true;
 #if ESP_IDF_VERSION_MAJOR < 5
-    it = nvs_entry_find("nvs", NULL, NVS_TYPE_ANY);
+    it = nvs_entry_find("nvs", prefs_ns.c_str(), NVS_TYPE_ANY);
 #else
-    res = nvs_entry_find("nvs", NULL, NVS_TYPE_ANY, &it);
+    res = nvs_entry_find("nvs", prefs_ns.c_str(), NVS_TYPE_ANY, &it);
 #endif
     while ((res == ESP_OK) && (it != NULL)) {
         nvs_entry_info_t info;
         nvs_entry_info(it, &info);
-        ls += info.namespace_name;
-        ls += "/";
-        ls += info.key;
-        ls += " (";
-        ls += String(info.type);
-        ls += ")\n";
-        // TODO print content size
+        cfg_entry * e = cache_insert(info.key);
+        if (e == NULL) {
+            // out of space, remaining keys are read through
+            break;
+        }
+        if (info.type == NVS_TYPE_I32) {
+            e->type = CFG_INT;
+            e->i = prefs.getInt(info.key, 0);
+        } else if (info.type == NVS_TYPE_STR) {
+            e->type = CFG_STRING;
+            e->s = prefs.getString(info.key);
+        } else if ((info.type == NVS_TYPE_BLOB) && (prefs.getBytesLength(info.key) == sizeof(float))) {
+            // Preferences stores floats as 4 byte blobs
+            e->type = CFG_FLOAT;
+            e->f = prefs.getFloat(info.key, 0);
+        } else {
+            // not something we wrote, leave for read through
+            e->type = CFG_EMPTY;
+            --cache_used;
+            cache_complete = false;
+        }
 #if ESP_IDF_VERSION_MAJOR < 5
         it = nvs_entry_next(it);
 #else
@@ -45,19 +257,902 @@ static void serve_config_list(AsyncWebServerRequest * request) {
 #endif
     }
     nvs_release_iterator(it);
-    AsyncWebServerResponse *response = request->beginResponse(200, "text/plain", ls);
+}
+#endif
+
+// tell subscribers about a committed value
+static void cfg_publish(const char * key, cfg_type t, int32_t i, float f, const String & s) {
+    const char * dot = strchr(key, '.');
+    if (dot == NULL) {
+        return;
+    }
+    String name(key);
+    name.remove(dot - key);
+    String id(dot + 1);
+    for (int n = 0; n < subscribers_used; ++n) {
+        const cfg_subscriber & sub = subscribers[n];
+        if (strncmp(key, sub.prefix, strlen(sub.prefix)) != 0) {
+            continue;
+        }
+        if (t == CFG_INT && sub.type == MYCFG_INT) {
+            sub.cb.i(name.c_str(), id, i);
+        } else if (t == CFG_FLOAT && sub.type == MYCFG_FLOAT) {
+            sub.cb.f(name.c_str(), id, f);
+        } else if (t == CFG_STRING && sub.type == MYCFG_STRING) {
+            sub.cb.s(name.c_str(), id, s);
+        }
+    }
+}
+
+// hand queued changes to the subscribers, does nothing while an outer
+// caller still holds the lock, it publishes them when it is done
+static void cfg_publish_pending() {
+    std::vector<cfg_entry> todo;
+    CFG_LOCK();
+    if (cfg_depth == 1) {
+        todo.swap(unpublished);
+    }
+    CFG_UNLOCK();
+    for (const cfg_entry & e : todo) {
+        cfg_publish(e.key, e.type, e.i, e.f, e.s);
+    }
+}
+
+static bool cfg_subscribe(const cfg_subscriber & sub) {
+    if (subscribers_used >= MYCFG_MAX_SUBSCRIBERS) {
+        Serial.printf("Config subscribers full, cannot add %s\n", sub.prefix);
+        return false;
+    }
+    subscribers[subscribers_used++] = sub;
+    return true;
+}
+
+bool MyCfgSubscribeInt(const char * prefix, MyCfgSubInt cb) {
+    cfg_subscriber sub = { prefix, MYCFG_INT };
+    sub.cb.i = cb;
+    return cfg_subscribe(sub);
+}
+
+bool MyCfgSubscribeFloat(const char * prefix, MyCfgSubFloat cb) {
+    cfg_subscriber sub = { prefix, MYCFG_FLOAT };
+    sub.cb.f = cb;
+    return cfg_subscribe(sub);
+}
+
+bool MyCfgSubscribeString(const char * prefix, MyCfgSubString cb) {
+    cfg_subscriber sub = { prefix, MYCFG_STRING };
+    sub.cb.s = cb;
+    return cfg_subscribe(sub);
+}
+
+#ifdef ESP32
+// the flush commits to flash, takes the config lock and calls subscribers,
+// none of which may happen in the esp_timer task, so the ticker only
+// wakes this task to do it
+static TaskHandle_t flush_task = NULL;
+
+// work handed over by MyCfgDefer
+#define MYCFG_DEFERRED 4
+static std::atomic<void (*)()> deferred[MYCFG_DEFERRED];
+
+static void cfg_flush_task(void *) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (int i = 0; i < MYCFG_DEFERRED; ++i) {
+            void (*fn)() = deferred[i].exchange(NULL);
+            if (fn) {
+                fn();
+            }
+        }
+        MyCfgFlush();
+    }
+}
+
+static void flush_notify() {
+    if (flush_task) {
+        xTaskNotifyGive(flush_task);
+    }
+}
+#endif
+
+bool MyCfgDefer(void (*fn)()) {
+#ifdef ESP32
+    for (int i = 0; i < MYCFG_DEFERRED; ++i) {
+        void (*expect)() = NULL;
+        if (deferred[i].compare_exchange_strong(expect, fn) || (expect == fn)) {
+            flush_notify();
+            return true;
+        }
+    }
+    return false;
+#else
+    fn();
+    return true;
+#endif
+}
+
+static void schedule_flush() {
+#ifdef ESP32
+    flush_ticker.once_ms(MYCFG_FLUSH_DELAY_MS, flush_notify);
+#else
+    // flash writes are not allowed from the timer context
+    flush_ticker.once_ms_scheduled(MYCFG_FLUSH_DELAY_MS, MyCfgFlush);
+#endif
+}
+
+// write a value straight to NVS, used when the cache cannot hold it
+static bool prefs_put(const cfg_entry & e) {
+    size_t saved = 0;
+    size_t want = 4;
+    switch (e.type) {
+        case CFG_INT: saved = prefs.putInt(e.key, e.i); break;
+        case CFG_FLOAT: saved = prefs.putFloat(e.key, e.f); break;
+        case CFG_STRING: saved = prefs.putString(e.key, e.s); want = e.s.length(); break;
+        default: break;
+    }
+    if (saved != want) {
+        LOGF(LOGM_CFG, LOG_CRIT, "Config save %s failed, wrote %u",e.key,saved);
+        return false;
+    }
+    return true;
+}
+
+// update the cache and schedule the write
+static bool cache_put(const char * key, cfg_type t, int32_t i, float f, const String & s) {
+    bool ret = true;
+    CFG_LOCK();
+    cfg_entry * e = cache_insert(key);
+    if (e == NULL) {
+        cfg_entry direct;
+        strcpy(direct.key, key);
+        direct.type = t;
+        direct.i = i;
+        direct.f = f;
+        direct.s = s;
+        ret = prefs_put(direct);
+        if (ret && subscribers_used) {
+            unpublished.push_back(direct);
+        }
+    } else {
+        e->type = t;
+        e->i = i;
+        e->f = f;
+        e->s = s;
+        e->dirty = true;
+        schedule_flush();
+    }
+    CFG_UNLOCK();
+    cfg_publish_pending();
+    return ret;
+}
+
+void MyCfgFlush() {
+    CFG_LOCK();
+    flush_ticker.detach();
+#ifdef ESP32
+    // one commit for the whole batch
+    nvs_handle_t h;
+    bool opened = (nvs_open(prefs_ns.c_str(), NVS_READWRITE, &h) == ESP_OK);
+#endif
+    int written = 0;
+    for (int n = 0; n < MYCFG_CACHE_SIZE; ++n) {
+        cfg_entry & e = cache[n];
+        if (!e.dirty) {
+            continue;
+        }
+        e.dirty = false;
+        ++written;
+        if (subscribers_used) {
+            unpublished.push_back(e);
+        }
+#ifdef ESP32
+        if (opened) {
+            esp_err_t err = ESP_FAIL;
+            switch (e.type) {
+                case CFG_INT: err = nvs_set_i32(h, e.key, e.i); break;
+                case CFG_FLOAT: err = nvs_set_blob(h, e.key, &e.f, sizeof(e.f)); break;
+                case CFG_STRING: err = nvs_set_str(h, e.key, e.s.c_str()); break;
+                default: break;
+            }
+            if (err != ESP_OK) {
+                LOGF(LOGM_CFG, LOG_CRIT, "Config save %s failed, error %d",e.key,err);
+            }
+            continue;
+        }
+#endif
+        prefs_put(e);
+    }
+#ifdef ESP32
+    if (opened) {
+        if (written && (nvs_commit(h) != ESP_OK)) {
+            LOGF(LOGM_CFG, LOG_CRIT, "Config commit failed");
+        }
+        nvs_close(h);
+    }
+#endif
+    CFG_UNLOCK();
+    cfg_publish_pending();
+}
+
+// typed accessors on a full key, getters return false if not set
+static bool cfg_get_int(const char * key, int & value) {
+    CFG_LOCK();
+    cfg_entry * e = cache_get(key, CFG_INT);
+    if (e) { value = e->i; }
+    CFG_UNLOCK();
+    return e != NULL;
+}
+static bool cfg_get_float(const char * key, float & value) {
+    CFG_LOCK();
+    cfg_entry * e = cache_get(key, CFG_FLOAT);
+    if (e) { value = e->f; }
+    CFG_UNLOCK();
+    return e != NULL;
+}
+static bool cfg_get_string(const char * key, String & value) {
+    CFG_LOCK();
+    cfg_entry * e = cache_get(key, CFG_STRING);
+    if (e) { value = e->s; }
+    CFG_UNLOCK();
+    return e != NULL;
+}
+static bool cfg_put_int(const char * key, int value) {
+    return cache_put(key, CFG_INT, value, 0, String());
+}
+static bool cfg_put_float(const char * key, float value) {
+    return cache_put(key, CFG_FLOAT, 0, value, String());
+}
+static bool cfg_put_string(const char * key, const String & value) {
+    return cache_put(key, CFG_STRING, 0, 0, value);
+}
+
+
+static int registry_search(const char * name, bool & found) {
+    int lo = 0;
+    int hi = registry_used;
+    found = false;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(registry[mid].name, name);
+        if (c == 0) {
+            found = true;
+            return mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const MyCfgDesc * registry_find(const char * name) {
+    bool found;
+    int i = registry_search(name, found);
+    return found ? &registry[i] : NULL;
+}
+
+void MyCfgRegister(const MyCfgDesc * descs, size_t count) {
+    for (size_t n = 0; n < count; ++n) {
+        bool found;
+        int i = registry_search(descs[n].name, found);
+        if (!found) {
+            if (registry_used >= MYCFG_MAX_NAMES) {
+                Serial.printf("Config registry full, cannot add %s\n", descs[n].name);
+                continue;
+            }
+            memmove(&registry[i+1], &registry[i], (registry_used - i) * sizeof(MyCfgDesc));
+            ++registry_used;
+        }
+        registry[i] = descs[n];
+    }
+}
+
+// one assignment in a batch, value is the textual form
+// type is a MyCfgType, or -1 to take it from the registered name
+struct cfg_assign {
+    String key;
+    String value;
+    int type;
+    const char * err;
+    int32_t i;
+    float f;
+    String s;
+};
+
+// a batch is first checked with MyCfgChecking() true, when handlers only
+// validate, so a rejected batch leaves nothing changed
+#ifdef ESP32
+static TaskHandle_t checking_task = NULL;
+#define CFG_TASK() xTaskGetCurrentTaskHandle()
+#else
+static void * checking_task = NULL;
+#define CFG_TASK() ((void *)1)
+#endif
+
+bool MyCfgChecking() {
+    return (checking_task != NULL) && (checking_task == CFG_TASK());
+}
+
+// run the handler for one assignment, parsing the value afresh
+static const char * cfg_assign_cb(cfg_assign & a, const MyCfgDesc * d, const String & name, const String & id) {
+    const char * err = NULL;
+    switch (a.type) {
+        case MYCFG_INT:
+            a.i = a.value.toInt();
+            if (d) { int v = a.i; err = (d->cb.i)(name.c_str(), id, v); a.i = v; }
+            break;
+        case MYCFG_FLOAT:
+            a.f = a.value.toFloat();
+            if (d) { err = (d->cb.f)(name.c_str(), id, a.f); }
+            break;
+        default:
+            a.s = a.value;
+            if (d) { err = (d->cb.s)(name.c_str(), id, a.s); }
+            break;
+    }
+    return err;
+}
+
+// true if the cache can take every key, so they all go in one commit
+static bool cache_room(const std::vector<cfg_assign> & batch) {
+    int needed = 0;
+    for (const cfg_assign & a : batch) {
+        cfg_entry * e = cache_slot(a.key.c_str());
+        if ((e == NULL) || (e->type == CFG_EMPTY)) {
+            ++needed;
+        }
+    }
+    return cache_used + needed <= MYCFG_CACHE_SIZE - 1;
+}
+
+// check every assignment, and only if all are accepted apply them
+// through their handlers and store them with a single commit
+// returns true if everything was applied
+static bool cfg_apply_batch(std::vector<cfg_assign> & batch) {
+    bool ok = true;
+    checking_task = CFG_TASK();
+    for (cfg_assign & a : batch) {
+        a.err = NULL;
+        int dot = a.key.indexOf('.');
+        char k[MYCFG_KEY_LEN];
+        if (dot < 1) {
+            a.err = "expected name.id";
+            ok = false;
+            continue;
+        }
+        String name = a.key.substring(0, dot);
+        String id = a.key.substring(dot + 1);
+        if (!cfg_key(k, name.c_str(), id)) {
+            a.err = "key too long";
+            ok = false;
+            continue;
+        }
+        const MyCfgDesc * d = registry_find(name.c_str());
+        if (d == NULL && a.type == -1) {
+            a.err = "Config name not found";
+            ok = false;
+            continue;
+        }
+        if (d != NULL && a.type != -1 && a.type != d->type) {
+            a.err = "type mismatch";
+            ok = false;
+            continue;
+        }
+        if (a.type == -1) {
+            a.type = d->type;
+        }
+        a.err = cfg_assign_cb(a, d, name, id);
+        if (a.err != NULL) {
+            ok = false;
+        }
+    }
+    checking_task = NULL;
+    if (!ok) {
+        return false;
+    }
+
+    // hold the lock so the flush cannot commit half the batch
+    CFG_LOCK();
+    if (!cache_room(batch)) {
+        CFG_UNLOCK();
+        for (cfg_assign & a : batch) {
+            a.err = "config cache full";
+        }
+        return false;
+    }
+    for (cfg_assign & a : batch) {
+        int dot = a.key.indexOf('.');
+        String name = a.key.substring(0, dot);
+        String id = a.key.substring(dot + 1);
+        a.err = cfg_assign_cb(a, registry_find(name.c_str()), name, id);
+        bool saved = false;
+        if (a.err == NULL) {
+            switch (a.type) {
+                case MYCFG_INT: saved = cfg_put_int(a.key.c_str(), a.i); break;
+                case MYCFG_FLOAT: saved = cfg_put_float(a.key.c_str(), a.f); break;
+                default: saved = cfg_put_string(a.key.c_str(), a.s); break;
+            }
+            if (!saved) {
+                a.err = "save failed";
+            }
+        }
+        if (!saved) {
+            ok = false;
+        }
+    }
+    MyCfgFlush();
+    CFG_UNLOCK();
+    cfg_publish_pending();
+    if (!ok) {
+        LOGF(LOGM_CFG, LOG_ERR, "Config batch of %d values only partly applied", (int)batch.size());
+        return false;
+    }
+    LOGF(LOGM_CFG, LOG_INFO, "Config batch of %d values applied", (int)batch.size());
+    return true;
+}
+
+// plain text report of a batch, one line per key
+static AsyncWebServerResponse * cfg_batch_response(AsyncWebServerRequest * request, bool ok, const std::vector<cfg_assign> & batch) {
+    String r;
+    for (const cfg_assign & a : batch) {
+        r += a.key;
+        r += ": ";
+        r += (a.err != NULL) ? a.err : (ok ? "ok" : "not applied");
+        r += "\n";
+    }
+    AsyncWebServerResponse * response = request->beginResponse(ok ? 200 : 400, "text/plain", r);
+    response->addHeader("Connection", "close");
+    return response;
+}
+
+static void json_string(String & out, const char * s) {
+    out += '"';
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') {
+            out += '\\';
+            out += *s;
+        } else if ((uint8_t)*s < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)*s);
+            out += esc;
+        } else {
+            out += *s;
+        }
+    }
+    out += '"';
+}
+
+// append one exported value as "t:key":value, false if not one of ours
+static bool export_entry(String & out, const char * key, bool first) {
+    int i;
+    float f;
+    String v;
+    char num[24];
+    if (!first) {
+        out += ',';
+    }
+    if (cfg_get_int(key, i)) {
+        out += "\"i:";
+        out += key;
+        snprintf(num, sizeof(num), "\":%d", i);
+        out += num;
+    } else if (cfg_get_float(key, f)) {
+        out += "\"f:";
+        out += key;
+        snprintf(num, sizeof(num), "\":%.9g", f);
+        out += num;
+    } else if (cfg_get_string(key, v)) {
+        out += "\"s:";
+        out += key;
+        out += "\":";
+        json_string(out, v.c_str());
+    } else {
+        if (!first) {
+            out.remove(out.length() - 1);
+        }
+        return false;
+    }
+    return true;
+}
+
+// GET /config/export
+// the whole namespace as {"i:name.id":1,"f:name.id":1.5,"s:name.id":"x"}
+static void serve_config_export(AsyncWebServerRequest * request) {
+    TRACE_SCOPE(TRACE_CFG_EXPORT);
+    HEAP_SCOPE(HEAP_CFG);
+    // make sure flash holds everything
+    MyCfgFlush();
+    struct walk {
+#ifdef ESP32
+        nvs_iterator_t it = NULL;
+        esp_err_t res = ESP_OK;
+        ~walk() { nvs_release_iterator(it); }
+#else
+        int slot = 0;
+#endif
+        bool started = false;
+        bool first = true;
+    };
+    std::shared_ptr<walk> w(new walk);
+    AsyncWebServerResponse * response = WS_stream_response(request, "application/json", [w](String & out) -> bool {
+        if (!w->started) {
+            w->started = true;
+            out += '{';
+#ifdef ESP32
+#if ESP_IDF_VERSION_MAJOR < 5
+            w->it = nvs_entry_find("nvs", prefs_ns.c_str(), NVS_TYPE_ANY);
+#else
+            w->res = nvs_entry_find("nvs", prefs_ns.c_str(), NVS_TYPE_ANY, &w->it);
+#endif
+#endif
+            return true;
+        }
+#ifdef ESP32
+        if ((w->res != ESP_OK) || (w->it == NULL)) {
+            out += '}';
+            return false;
+        }
+        nvs_entry_info_t info;
+        nvs_entry_info(w->it, &info);
+        if (export_entry(out, info.key, w->first)) {
+            w->first = false;
+        }
+#if ESP_IDF_VERSION_MAJOR < 5
+        w->it = nvs_entry_next(w->it);
+#else
+        w->res = nvs_entry_next(&w->it);
+#endif
+#else
+        // no way to list preferences here, export what has been used
+        if (w->slot >= MYCFG_CACHE_SIZE) {
+            out += '}';
+            return false;
+        }
+        char key[MYCFG_KEY_LEN];
+        CFG_LOCK();
+        cfg_type t = cache[w->slot].type;
+        strcpy(key, cache[w->slot].key);
+        CFG_UNLOCK();
+        ++w->slot;
+        if ((t != CFG_EMPTY) && (t != CFG_ABSENT) && export_entry(out, key, w->first)) {
+            w->first = false;
+        }
+#endif
+        return true;
+    });
+    response->addHeader("Content-Disposition", "attachment; filename=\"config.json\"");
+    response->addHeader("Connection", "close");
     request->send(response);
 }
+
+// collects the assignments from an exported blob
+// final so it can be deleted without a virtual destructor in the base
+class cfg_import_handler final : public JsonHandler {
+    public:
+        std::vector<cfg_assign> batch;
+        bool bad = false;
+        virtual void startDocument() {}
+        virtual void startArray(ElementPath path) { bad = true; }
+        virtual void startObject(ElementPath path) {}
+        virtual void endArray(ElementPath path) {}
+        virtual void endObject(ElementPath path) {}
+        virtual void endDocument() {}
+        virtual void whitespace(char c) {}
+        virtual void value(ElementPath path, ElementValue value) {
+            char key[200] = "";
+            path.toString(key);
+            if (strlen(key) < 3 || key[1] != ':') {
+                bad = true;
+                return;
+            }
+            cfg_assign a = { key + 2, String(), -1, NULL, 0, 0, String() };
+            switch (key[0]) {
+                case 'i': a.type = MYCFG_INT; a.value = String(value.getInt()); break;
+                case 'f': {
+                    // as many digits as export wrote, so floats survive the trip
+                    char num[24];
+                    snprintf(num, sizeof(num), "%.9g", value.getFloat());
+                    a.type = MYCFG_FLOAT;
+                    a.value = num;
+                    break;
+                }
+                case 's': a.type = MYCFG_STRING; a.value = value.getString(); break;
+                default: bad = true; return;
+            }
+            batch.push_back(a);
+        }
+};
+
+// the library parser has no virtual destructor, deleting it through
+// this final type keeps that well defined
+class cfg_import_parser final : public ArudinoStreamParser {};
+
+// one import at a time, the request's temp object is released with free()
+// so cannot own the parser
+static struct cfg_import {
+    AsyncWebServerRequest * owner = NULL;
+    cfg_import_parser * parser = NULL;
+    cfg_import_handler * handler = NULL;
+    void reset() {
+        delete parser;
+        delete handler;
+        parser = NULL;
+        handler = NULL;
+        owner = NULL;
+    }
+} import_state;
+
+static void serve_config_import_body(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) {
+    if (index == 0) {
+        import_state.reset();
+        import_state.owner = request;
+        import_state.parser = new cfg_import_parser;
+        import_state.handler = new cfg_import_handler;
+        import_state.parser->setHandler(import_state.handler);
+    }
+    if (import_state.owner != request) {
+        return;
+    }
+    Print & p = *import_state.parser;
+    p.write(data, len);
+}
+
+// POST /config/import with a blob from /config/export as the body
+static void serve_config_import(AsyncWebServerRequest * request) {
+    TRACE_SCOPE(TRACE_CFG_IMPORT);
+    HEAP_SCOPE(HEAP_CFG);
+    AsyncWebServerResponse * response;
+    if ((import_state.owner != request) || (import_state.handler == NULL)) {
+        response = request->beginResponse(400, "text/plain", "No config blob received");
+        response->addHeader("Connection", "close");
+    } else if (import_state.handler->bad || import_state.handler->batch.empty()) {
+        response = request->beginResponse(400, "text/plain", "Config blob not recognised");
+        response->addHeader("Connection", "close");
+    } else {
+        std::vector<cfg_assign> & batch = import_state.handler->batch;
+        bool ok = cfg_apply_batch(batch);
+        response = cfg_batch_response(request, ok, batch);
+    }
+    import_state.reset();
+    request->send(response);
+}
+
+#ifdef ESP32
+static const char * nvs_type_name(nvs_type_t t) {
+    switch (t) {
+        case NVS_TYPE_U8: return "u8";
+        case NVS_TYPE_I8: return "i8";
+        case NVS_TYPE_U16: return "u16";
+        case NVS_TYPE_I16: return "i16";
+        case NVS_TYPE_U32: return "u32";
+        case NVS_TYPE_I32: return "i32";
+        case NVS_TYPE_U64: return "u64";
+        case NVS_TYPE_I64: return "i64";
+        case NVS_TYPE_STR: return "str";
+        case NVS_TYPE_BLOB: return "blob";
+        default: return "?";
+    }
+}
+
+// append "size value" for an entry
+static void nvs_describe(String & out, const nvs_entry_info_t & info) {
+    nvs_handle_t h;
+    char num[32] = "?";
+    size_t len = 0;
+    if (nvs_open(info.namespace_name, NVS_READONLY, &h) != ESP_OK) {
+        out += "? (cannot open namespace)";
+        return;
+    }
+    switch (info.type) {
+        case NVS_TYPE_U8: { uint8_t v; nvs_get_u8(h, info.key, &v); len = 1; snprintf(num, sizeof(num), "%u", v); break; }
+        case NVS_TYPE_I8: { int8_t v; nvs_get_i8(h, info.key, &v); len = 1; snprintf(num, sizeof(num), "%d", v); break; }
+        case NVS_TYPE_U16: { uint16_t v; nvs_get_u16(h, info.key, &v); len = 2; snprintf(num, sizeof(num), "%u", v); break; }
+        case NVS_TYPE_I16: { int16_t v; nvs_get_i16(h, info.key, &v); len = 2; snprintf(num, sizeof(num), "%d", v); break; }
+        case NVS_TYPE_U32: { uint32_t v; nvs_get_u32(h, info.key, &v); len = 4; snprintf(num, sizeof(num), "%lu", (unsigned long)v); break; }
+        case NVS_TYPE_I32: { int32_t v; nvs_get_i32(h, info.key, &v); len = 4; snprintf(num, sizeof(num), "%ld", (long)v); break; }
+        case NVS_TYPE_U64: { uint64_t v; nvs_get_u64(h, info.key, &v); len = 8; snprintf(num, sizeof(num), "%llu", (unsigned long long)v); break; }
+        case NVS_TYPE_I64: { int64_t v; nvs_get_i64(h, info.key, &v); len = 8; snprintf(num, sizeof(num), "%lld", (long long)v); break; }
+        default: break;
+    }
+    if (info.type == NVS_TYPE_STR) {
+        nvs_get_str(h, info.key, NULL, &len);
+        out += String(len);
+        out += ' ';
+        // only show the start of long strings
+        char v[65];
+        size_t l = sizeof(v);
+        if (len <= l) {
+            nvs_get_str(h, info.key, v, &l);
+            json_string(out, v);
+        } else {
+            out += "(long)";
+        }
+    } else if (info.type == NVS_TYPE_BLOB) {
+        nvs_get_blob(h, info.key, NULL, &len);
+        out += String(len);
+        uint8_t v[16];
+        size_t l = sizeof(v);
+        if ((len <= l) && (nvs_get_blob(h, info.key, v, &l) == ESP_OK)) {
+            out += ' ';
+            for (size_t n = 0; n < l; ++n) {
+                snprintf(num, sizeof(num), "%02x", v[n]);
+                out += num;
+            }
+            if (l == sizeof(float)) {
+                // how Preferences stores floats
+                float f;
+                memcpy(&f, v, sizeof(f));
+                snprintf(num, sizeof(num), " (%g)", f);
+                out += num;
+            }
+        }
+    } else {
+        out += String(len);
+        out += ' ';
+        out += num;
+    }
+    nvs_close(h);
+}
 #endif
 
+// GET /configlist[?prefix=XX][&offset=N][&limit=M]
+// one line per entry: namespace/key type size value
+// prefix matches the start of the key, offset/limit count matching entries
+static void serve_config_list(AsyncWebServerRequest * request) {
+    TRACE_SCOPE(TRACE_CFG_LIST);
+    HEAP_SCOPE(HEAP_CFG);
+    struct walk {
+#ifdef ESP32
+        nvs_iterator_t it = NULL;
+        esp_err_t res = ESP_OK;
+        ~walk() { nvs_release_iterator(it); }
+#else
+        int slot = 0;
+#endif
+        String prefix;
+        int offset = 0;
+        int limit = -1;
+        int matched = 0;
+        bool started = false;
+    };
+    std::shared_ptr<walk> w(new walk);
+    if (request->hasParam("prefix")) {
+        w->prefix = request->getParam("prefix")->value();
+    }
+    if (request->hasParam("offset")) {
+        w->offset = request->getParam("offset")->value().toInt();
+    }
+    if (request->hasParam("limit")) {
+        w->limit = request->getParam("limit")->value().toInt();
+    }
+    // flash should reflect what we report
+    MyCfgFlush();
+    AsyncWebServerResponse * response = WS_stream_response(request, "text/plain", [w](String & out) -> bool {
+        if (!w->started) {
+            w->started = true;
+#ifdef ESP32
+            nvs_stats_t stats;
+            if (nvs_get_stats(NULL, &stats) == ESP_OK) {
+                out += "# entries used ";
+                out += String(stats.used_entries);
+                out += " free ";
+                out += String(stats.free_entries);
+                out += " total ";
+                out += String(stats.total_entries);
+                out += " namespaces ";
+                out += String(stats.namespace_count);
+            }
+            nvs_handle_t h;
+            size_t used;
+            if ((nvs_open(prefs_ns.c_str(), NVS_READONLY, &h) == ESP_OK)) {
+                if (nvs_get_used_entry_count(h, &used) == ESP_OK) {
+                    out += ", ";
+                    out += prefs_ns;
+                    out += " uses ";
+                    out += String(used);
+                }
+                nvs_close(h);
+            }
+            out += '\n';
+#if ESP_IDF_VERSION_MAJOR < 5
+            w->it = nvs_entry_find("nvs", NULL, NVS_TYPE_ANY);
+#else
+            w->res = nvs_entry_find("nvs", NULL, NVS_TYPE_ANY, &w->it);
+#endif
+#else
+            out += "# cached entries only\n";
+#endif
+            return true;
+        }
+#ifdef ESP32
+        if ((w->res != ESP_OK) || (w->it == NULL)) {
+            return false;
+        }
+        nvs_entry_info_t info;
+        nvs_entry_info(w->it, &info);
+#if ESP_IDF_VERSION_MAJOR < 5
+        w->it = nvs_entry_next(w->it);
+#else
+        w->res = nvs_entry_next(&w->it);
+#endif
+        const char * key = info.key;
+#else
+        if (w->slot >= MYCFG_CACHE_SIZE) {
+            return false;
+        }
+        char key[MYCFG_KEY_LEN];
+        CFG_LOCK();
+        cfg_type t = cache[w->slot].type;
+        strcpy(key, cache[w->slot].key);
+        CFG_UNLOCK();
+        ++w->slot;
+        if ((t == CFG_EMPTY) || (t == CFG_ABSENT)) {
+            return true;
+        }
+#endif
+        if (strncmp(key, w->prefix.c_str(), w->prefix.length()) != 0) {
+            return true;
+        }
+        int n = w->matched++;
+        if (n < w->offset) {
+            return true;
+        }
+        if ((w->limit >= 0) && (n >= w->offset + w->limit)) {
+            out += "# more entries from offset=";
+            out += String(n);
+            out += '\n';
+            return false;
+        }
+#ifdef ESP32
+        out += info.namespace_name;
+        out += '/';
+        out += key;
+        out += ' ';
+        out += nvs_type_name(info.type);
+        out += ' ';
+        nvs_describe(out, info);
+#else
+        int i;
+        float f;
+        String v;
+        out += prefs_ns;
+        out += '/';
+        out += key;
+        if (cfg_get_int(key, i)) {
+            out += " i32 4 ";
+            out += String(i);
+        } else if (cfg_get_float(key, f)) {
+            out += " float 4 ";
+            out += String(f);
+        } else if (cfg_get_string(key, v)) {
+            out += " str ";
+            out += String(v.length());
+            out += ' ';
+            json_string(out, v.c_str());
+        }
+#endif
+        out += '\n';
+        return true;
+    });
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
 static void serve_config_clear(AsyncWebServerRequest * request) {
+    HEAP_SCOPE(HEAP_CFG);
     AsyncWebServerResponse *response = request->beginResponse(200, "text/html", "<html><head><meta http-equiv=\"refresh\" content=\"10; url=/\"></head><body>Config cleared; rebooting... bye bye...</body></html>");
     response->addHeader("Connection", "close");
     // TODO how to defer the restart until the response has been sent?
     request->send(response);
+    CFG_LOCK();
+    flush_ticker.detach();
+    cache_clear();
     prefs.clear();
     prefs.end();
-    syslogf(LOG_DAEMON|LOG_CRIT,"Config clear, restarting");
+    CFG_UNLOCK();
+    LOGF(LOGM_CFG, LOG_CRIT, "Config clear, restarting");
     Serial.printf("Config cleared, restarting");
     WIFI_going_for_reboot();
     delay(1000);
@@ -65,6 +1160,8 @@ static void serve_config_clear(AsyncWebServerRequest * request) {
 }
 
 static void serve_config_get(AsyncWebServerRequest * request) {
+    TRACE_SCOPE(TRACE_CFG_GET);
+    HEAP_SCOPE(HEAP_CFG);
     String x,y;
     AsyncWebServerResponse *response = nullptr;
     String respStr;
@@ -77,13 +1174,17 @@ static void serve_config_get(AsyncWebServerRequest * request) {
     } else {
         x = request->getParam("name")->value();
         y = request->getParam("id")->value();
+        const MyCfgDesc * d = registry_find(x.c_str());
 
-        if (config_int.find(x) != config_int.end()) {
+        if (d == NULL) {
+            response = request->beginResponse(400, "text/plain", "Config name not found");
+        } else if (d->type == MYCFG_INT) {
             if (!request->hasParam("value")) {
                 // respond with current value
+                int v;
                 x += "." + y;
-                if (prefs.isKey(x.c_str())) {
-                    response = request->beginResponse(200, "text/plain", String(prefs.getInt(x.c_str(),0)));
+                if (cfg_get_int(x.c_str(), v)) {
+                    response = request->beginResponse(200, "text/plain", String(v));
                 } else {
                     x = x + " not set";
                     response = request->beginResponse(404, "text/plain", x.c_str());
@@ -91,25 +1192,26 @@ static void serve_config_get(AsyncWebServerRequest * request) {
             } else {
                 // set new int value
                 int z = request->getParam("value")->value().toInt();
-                const char * e = (config_int.find(x)->second)(x.c_str(),y,z);
+                const char * e = (d->cb.i)(x.c_str(),y,z);
                 if (e == NULL) {
                     x += "." + y;
-                    if (prefs.putInt(x.c_str(),z) != 4) {
+                    if (!cfg_put_int(x.c_str(),z)) {
                         response = request->beginResponse(500, "text/plain", "failed to save preference");
                     } else {
-                        syslogf("Set %s to %d",x,z);
+                        LOGF(LOGM_CFG, LOG_INFO, "Set %s to %d",x.c_str(),z);
                         respStr = String(z);
                     }
                 } else {
                     response = request->beginResponse(400, "text/plain", e);
                 }
             }
-        } else if (config_float.find(x) != config_float.end()) {
+        } else if (d->type == MYCFG_FLOAT) {
             if (!request->hasParam("value")) {
                 // respond with current value
+                float v;
                 x += "." + y;
-                if (prefs.isKey(x.c_str())) {
-                    response = request->beginResponse(200, "text/plain", String(prefs.getFloat(x.c_str(),0)));
+                if (cfg_get_float(x.c_str(), v)) {
+                    response = request->beginResponse(200, "text/plain", String(v));
                 } else {
                     x = x + " not set";
                     response = request->beginResponse(404, "text/plain", x.c_str());
@@ -117,13 +1219,13 @@ static void serve_config_get(AsyncWebServerRequest * request) {
             } else {
                 // set new float value
                 float z = request->getParam("value")->value().toFloat();
-                const char * e = (config_float.find(x)->second)(x.c_str(),y,z);
+                const char * e = (d->cb.f)(x.c_str(),y,z);
                 if (e == NULL) {
                     x += "." + y;
-                    if (prefs.putFloat(x.c_str(),z) != 4) {
+                    if (!cfg_put_float(x.c_str(),z)) {
                         response = request->beginResponse(500, "text/plain", "failed to save preference");
                     } else {
-                        syslogf("Set %s to %f",x,z);
+                        LOGF(LOGM_CFG, LOG_INFO, "Set %s to %f",x.c_str(),z);
                         respStr = String(z);
                     }
                 } else {
@@ -131,12 +1233,13 @@ static void serve_config_get(AsyncWebServerRequest * request) {
                 }
             }
 
-        } else if (config_string.find(x) != config_string.end()) {
+        } else {
             if (!request->hasParam("value")) {
                 // respond with current value
+                String v;
                 x += "." + y;
-                if (prefs.isKey(x.c_str())) {
-                    response = request->beginResponse(200, "text/plain", prefs.getString(x.c_str()));
+                if (cfg_get_string(x.c_str(), v)) {
+                    response = request->beginResponse(200, "text/plain", v);
                 } else {
                     x = x + " not set";
                     response = request->beginResponse(404, "text/plain", x.c_str());
@@ -144,22 +1247,19 @@ static void serve_config_get(AsyncWebServerRequest * request) {
             } else {
                 // set new string value
                 String z = request->getParam("value")->value();
-                const char * e = (config_string.find(x)->second)(x.c_str(),y,z);
+                const char * e = (d->cb.s)(x.c_str(),y,z);
                 if (e == NULL) {
                     x += "." + y;
-                    if (prefs.putString(x.c_str(),z) != z.length()) {
+                    if (!cfg_put_string(x.c_str(),z)) {
                         response = request->beginResponse(500, "text/plain", "failed to save preference");
                     } else {
-                        syslogf("Set %s to %s",x,z.c_str());
+                        LOGF(LOGM_CFG, LOG_INFO, "Set %s to %s",x.c_str(),z.c_str());
                         respStr = z;
                     }
                 } else {
                     response = request->beginResponse(400, "text/plain", e);
                 }
             }
-
-        } else {
-            response = request->beginResponse(400, "text/plain", "Config name not found");
         }
     }
     if (response == nullptr) {
@@ -173,75 +1273,101 @@ static void serve_config_get(AsyncWebServerRequest * request) {
     request->send(response);
 }
 
+// POST /config with a form body of name.id=value pairs
+static void serve_config_post(AsyncWebServerRequest * request) {
+    TRACE_SCOPE(TRACE_CFG_POST);
+    HEAP_SCOPE(HEAP_CFG);
+    std::vector<cfg_assign> batch;
+    for (size_t n = 0; n < request->params(); ++n) {
+        const AsyncWebParameter * p = request->getParam(n);
+        if (!p->isPost() || p->isFile()) {
+            continue;
+        }
+        batch.push_back({ p->name(), p->value(), -1, NULL, 0, 0, String() });
+    }
+    if (batch.empty()) {
+        AsyncWebServerResponse *response = request->beginResponse(400, "text/plain", "No name.id=value pairs in body");
+        response->addHeader("Connection", "close");
+        request->send(response);
+        return;
+    }
+    bool ok = cfg_apply_batch(batch);
+    request->send(cfg_batch_response(request, ok, batch));
+}
+
 void MyCfgRegisterInt(const char * name, MyCfgCbInt cb) {
-    config_int[name] = cb;
+    MyCfgDesc d(name, cb);
+    MyCfgRegister(&d, 1);
 }
 
 void MyCfgRegisterFloat(const char * name, MyCfgCbFloat cb) {
-    config_float[name] = cb;
+    MyCfgDesc d(name, cb);
+    MyCfgRegister(&d, 1);
 }
 
 void MyCfgRegisterString(const char * name, MyCfgCbString cb) {
-    config_string[name] = cb;
+    MyCfgDesc d(name, cb);
+    MyCfgRegister(&d, 1);
 }
 
 void MyCfgInit(bool _redirectToRoot, const char * ns) {
     redirectToRoot = _redirectToRoot;
+    prefs_ns = ns;
     Serial.printf("Starting config in namespace \"%s\"\n",ns?ns:"none");
     if (prefs.begin(ns, false) == false) {
         Serial.println("Failed to begin preferences library!");
     }
+#ifdef ESP32
+    cfg_mutex = xSemaphoreCreateRecursiveMutex();
+    cache_load();
+    xTaskCreate(cfg_flush_task, "CF", 4096, NULL, 1, &flush_task);
+#endif
+    // these must come before /config which would otherwise match them
+    server.on("/config/export", HTTP_GET, serve_config_export);
+    server.on("/config/import", HTTP_POST, serve_config_import, NULL, serve_config_import_body);
     server.on("/config", HTTP_GET, serve_config_get);
+    server.on("/config", HTTP_POST, serve_config_post);
     server.on("/configreset", HTTP_GET, serve_config_clear);
-#ifdef ESP32
     server.on("/configlist", HTTP_GET, serve_config_list);
-#endif
 }
 
 int MyCfgGetInt(const char * name, const String & id, int def) {
-    String i = name;
-    i += "." + id;
-    return prefs.getInt(i.c_str(),def);
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    if (cfg_key(k, name, id)) {
+        cfg_get_int(k, def);
+    }
+    return def;
 }
 float MyCfgGetFloat(const char * name, const String & id, float def) {
-    String i = name;
-    i += "." + id;
-    return prefs.getFloat(i.c_str(),def);
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    if (cfg_key(k, name, id)) {
+        cfg_get_float(k, def);
+    }
+    return def;
 }
 String MyCfgGetString(const char * name, const String & id, const String & def) {
-    String i = name;
-    i += "." + id;
-    return prefs.getString(i.c_str(),def);
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    String v = def;
+    if (cfg_key(k, name, id)) {
+        cfg_get_string(k, v);
+    }
+    return v;
 }
 bool MyCfgPutInt(const char * name, const String & id, int value) {
-    String i = name;
-    i += "." + id;
-    if (prefs.putInt(i.c_str(),value) != 4) {
-        syslogf(LOG_DAEMON|LOG_CRIT,"Config save %s failed",i.c_str());
-        return false;
-    } else {
-        return true;
-    }
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    return cfg_key(k, name, id) && cfg_put_int(k, value);
 }
 bool MyCfgPutFloat(const char * name, const String & id, float value) {
-    String i = name;
-    i += "." + id;
-    if (prefs.putFloat(i.c_str(),value) != 4) {
-        syslogf(LOG_DAEMON|LOG_CRIT,"Config save %s failed",i.c_str());
-        return false;
-    } else {
-        return true;
-    }
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    return cfg_key(k, name, id) && cfg_put_float(k, value);
 }
 bool MyCfgPutString(const char * name, const String & id, const String & value) {
-    String i = name;
-    i += "." + id;
-    size_t saved = prefs.putString(i.c_str(),value);
-    if (saved != value.length()) {
-        syslogf(LOG_DAEMON|LOG_CRIT,"Config save %s failed, wrote %u",i.c_str(),saved);
-        return false;
-    } else {
-        return true;
-    }
+    HEAP_SCOPE(HEAP_CFG);
+    char k[MYCFG_KEY_LEN];
+    return cfg_key(k, name, id) && cfg_put_string(k, value);
 }
-
@@ -11,6 +11,21 @@ handler called with XX, YY, ZZ (ZZ = reference s.t. it can be overridden)
 handler returns NULL/error message to indicate acceptance
 saves in prefs as XX.YY
 
+many values can be set at once with a form POST to /config of XX.YY=ZZ
+pairs, each is first checked by its handler with MyCfgChecking() true and
+only if all are accepted are the handlers run for real and the values saved
+in a single commit, the response lists the result for each key
+so a handler must not change any state while MyCfgChecking() is true
+
+/config/export returns every value as {"i:XX.YY":1,"f:XX.YY":1.5,"s:XX.YY":"ZZ"}
+and POSTing that back to /config/import applies it as one batch
+
+/configlist[?prefix=XX&offset=N&limit=M] lists stored entries with their
+type, size and value, preceded by the NVS usage figures
+
+values are cached in RAM, writes are committed to flash in a batch shortly
+after the last one or when MyCfgFlush is called
+
 */
 
 // must be called first
@@ -23,11 +38,55 @@ typedef const char * (*MyCfgCbInt)(const char * name, const String & id, int &va
 typedef const char * (*MyCfgCbFloat)(const char * name, const String & id, float &value);
 typedef const char * (*MyCfgCbString)(const char * name, const String & id, String &value);
 
+// describes a config set of "name" and the callback which validates it
+// declare tables of these constexpr so they live in flash, e.g.
+//     static constexpr MyCfgDesc cfg[] = { { "fcst", &handleInt }, { "weather", &handleUrl } };
+//     MyCfgRegister(cfg);
+// name must have static storage
+enum MyCfgType : uint8_t { MYCFG_INT, MYCFG_FLOAT, MYCFG_STRING };
+union MyCfgCb {
+    MyCfgCbInt i;
+    MyCfgCbFloat f;
+    MyCfgCbString s;
+    constexpr MyCfgCb(MyCfgCbInt c) : i(c) {}
+    constexpr MyCfgCb(MyCfgCbFloat c) : f(c) {}
+    constexpr MyCfgCb(MyCfgCbString c) : s(c) {}
+};
+struct MyCfgDesc {
+    const char * name;
+    MyCfgType type;
+    MyCfgCb cb;
+    constexpr MyCfgDesc() : name(""), type(MYCFG_INT), cb((MyCfgCbInt)nullptr) {}
+    constexpr MyCfgDesc(const char * n, MyCfgCbInt c) : name(n), type(MYCFG_INT), cb(c) {}
+    constexpr MyCfgDesc(const char * n, MyCfgCbFloat c) : name(n), type(MYCFG_FLOAT), cb(c) {}
+    constexpr MyCfgDesc(const char * n, MyCfgCbString c) : name(n), type(MYCFG_STRING), cb(c) {}
+};
+
+// true while a handler is being asked only to validate its value
+extern bool MyCfgChecking();
+
+// register a table of config sets, replaces any existing registration of a name
+extern void MyCfgRegister(const MyCfgDesc * descs, size_t count);
+template<size_t N> inline void MyCfgRegister(const MyCfgDesc (&descs)[N]) { MyCfgRegister(descs, N); }
+
 // register interest in a config set of "name"
 extern void MyCfgRegisterInt(const char * name, MyCfgCbInt cb);
 extern void MyCfgRegisterFloat(const char * name, MyCfgCbFloat cb);
 extern void MyCfgRegisterString(const char * name, MyCfgCbString cb);
 
+// subscribe to committed changes of any "name.id" starting with prefix
+// (e.g. "trremap." or "fcst.rate"), any number of subscribers may watch the
+// same keys and they are given the parsed value so need not read it back
+// called from whichever task commits the change so keep them short, never
+// with the config locked so they may read and write config themselves
+// prefix must have static storage
+typedef void (*MyCfgSubInt)(const char * name, const String & id, int value);
+typedef void (*MyCfgSubFloat)(const char * name, const String & id, float value);
+typedef void (*MyCfgSubString)(const char * name, const String & id, const String & value);
+extern bool MyCfgSubscribeInt(const char * prefix, MyCfgSubInt cb);
+extern bool MyCfgSubscribeFloat(const char * prefix, MyCfgSubFloat cb);
+extern bool MyCfgSubscribeString(const char * prefix, MyCfgSubString cb);
+
 // retrieve a config value of "id" inside "name"
 extern int MyCfgGetInt(const char * name, const String & id, int def);
 extern float MyCfgGetFloat(const char * name, const String & id, float def);
@@ -37,3 +96,13 @@ extern String MyCfgGetString(const char * name, const String & id, const String
 extern bool MyCfgPutInt(const char * name, const String & id, int value);
 extern bool MyCfgPutFloat(const char * name, const String & id, float value);
 extern bool MyCfgPutString(const char * name, const String & id, const String & value);
+
+// commit any pending writes now, call before restarting
+extern void MyCfgFlush();
+
+// run fn soon from a task that may use the config, for timer callbacks
+// which must not take the config lock themselves
+// on ESP32 it runs in the flush task, on ESP8266 straight away since the
+// tickers there are already scheduled into loop
+// each fn is queued at most once, false if too many are waiting
+extern bool MyCfgDefer(void (*fn)());
@@ -0,0 +1,18 @@
+// crc32 for the small records kept in RTC memory across resets
+// uses the ROM routine so callers don't pull in the gzip code
+// only ever compared against itself, the variant differs per platform
+#pragma once
+#include <Arduino.h>
+#ifdef ESP8266
+#include <coredecls.h>
+#else
+#include <rom/crc.h>
+#endif
+
+inline uint32_t CRC_32(const void * data, size_t len) {
+#ifdef ESP8266
+    return crc32(data, len);
+#else
+    return crc32_le(0, (const uint8_t *)data, len);
+#endif
+}
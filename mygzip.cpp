@@ -0,0 +1,238 @@
+// small streaming gzip compressor
+// output is a single fixed huffman block (RFC 1951 3.2.6) followed by an
+// empty final block, wrapped in a minimal gzip header and trailer
+#include <Arduino.h>
+#include <mygzip.h>
+
+// how far back matches may reach, the buffer holds twice this
+#ifndef GZ_WINDOW
+#define GZ_WINDOW 4096
+#endif
+#define GZ_BUF (GZ_WINDOW * 2)
+#define GZ_HASH_BITS 10
+#define GZ_MIN_MATCH 3
+#define GZ_MAX_MATCH 258
+
+uint32_t GZ_crc32(uint32_t crc, const uint8_t * data, size_t len) {
+    // nibble table, small and fast enough for flash sized inputs
+    static const uint32_t t[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ t[crc & 15];
+        crc = (crc >> 4) ^ t[crc & 15];
+    }
+    return ~crc;
+}
+
+static const uint16_t len_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+gzipStream::gzipStream(source s) :
+    src(s), state(GZ_HEADER), base(0), pos(0), end(0), eof(false),
+    crc(0), bitbuf(0), nbits(0), outlen(0), outpos(0)
+{
+    win = (uint8_t *)malloc(GZ_BUF);
+    head = (uint16_t *)malloc(sizeof(uint16_t) << GZ_HASH_BITS);
+    if (head == NULL) {
+        free(win);
+        win = NULL;
+    } else {
+        // positions are stored +1 so 0 means empty
+        memset(head, 0, sizeof(uint16_t) << GZ_HASH_BITS);
+    }
+}
+
+gzipStream::~gzipStream() {
+    free(win);
+    free(head);
+}
+
+// deflate packs bits starting at the least significant
+void gzipStream::bits(uint32_t v, int n) {
+    bitbuf |= v << nbits;
+    nbits += n;
+    while (nbits >= 8) {
+        out[outlen++] = bitbuf;
+        bitbuf >>= 8;
+        nbits -= 8;
+    }
+}
+
+// huffman codes go most significant bit first
+void gzipStream::code(uint32_t c, int n) {
+    uint32_t r = 0;
+    for (int i = 0; i < n; ++i) {
+        r = (r << 1) | (c & 1);
+        c >>= 1;
+    }
+    bits(r, n);
+}
+
+void gzipStream::literal(int c) {
+    if (c < 144) {
+        code(0x30 + c, 8);
+    } else if (c < 256) {
+        code(0x190 + c - 144, 9);
+    } else if (c < 280) {
+        code(c - 256, 7);
+    } else {
+        code(0xc0 + c - 280, 8);
+    }
+}
+
+void gzipStream::match(int len, int dist) {
+    int i = 28;
+    while (len_base[i] > len) { --i; }
+    literal(257 + i);
+    bits(len - len_base[i], len_extra[i]);
+    int j = 29;
+    while (dist_base[j] > dist) { --j; }
+    code(j, 5);
+    bits(dist - dist_base[j], dist_extra[j]);
+}
+
+uint32_t gzipStream::hash(size_t p) const {
+    const uint8_t * b = win + (p - base);
+    uint32_t v = b[0] | (b[1] << 8) | (b[2] << 16);
+    return (v * 2654435761u) >> (32 - GZ_HASH_BITS);
+}
+
+// keep at least a maximal match of lookahead in the buffer
+void gzipStream::refill() {
+    if (eof || (end - pos >= GZ_MAX_MATCH)) {
+        return;
+    }
+    if (end - base == GZ_BUF) {
+        // slide so that a full window stays behind pos
+        size_t drop = pos - base - GZ_WINDOW;
+        memmove(win, win + drop, GZ_BUF - drop);
+        base += drop;
+    }
+    while (!eof && (end - base < GZ_BUF)) {
+        size_t n = src(win + (end - base), GZ_BUF - (end - base));
+        if (n == 0) {
+            eof = true;
+        } else {
+            crc = GZ_crc32(crc, win + (end - base), n);
+            end += n;
+        }
+    }
+}
+
+// encode a few tokens, never more than fits in out
+void gzipStream::step() {
+    switch (state) {
+        case GZ_HEADER: {
+            // no name, no mtime, unknown OS
+            static const uint8_t hdr[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+            memcpy(out, hdr, sizeof(hdr));
+            outlen = sizeof(hdr);
+            // non final block with fixed codes
+            bits(0, 1);
+            bits(1, 2);
+            state = GZ_DATA;
+            break;
+        }
+        case GZ_DATA:
+            while (outlen + 8 <= sizeof(out)) {
+                refill();
+                size_t avail = end - pos;
+                if (avail == 0) {
+                    // end of block, then an empty final block
+                    literal(256);
+                    bits(1, 1);
+                    bits(1, 2);
+                    literal(256);
+                    if (nbits) {
+                        bits(0, 8 - nbits);
+                    }
+                    state = GZ_TRAILER;
+                    break;
+                }
+                int best = 0;
+                size_t from = 0;
+                if (avail >= GZ_MIN_MATCH) {
+                    uint32_t h = hash(pos);
+                    // head holds the low 16 bits of the position, the
+                    // window is small enough for that to be unambiguous
+                    uint16_t cand = head[h];
+                    head[h] = (uint16_t)(pos + 1);
+                    if (cand != 0) {
+                        size_t c = (pos & ~(size_t)0xffff) | (uint16_t)(cand - 1);
+                        if (c >= pos) { c -= 0x10000; }
+                        if ((c < pos) && (c >= base) && (pos - c <= GZ_WINDOW)) {
+                            const uint8_t * a = win + (pos - base);
+                            const uint8_t * b = win + (c - base);
+                            int limit = (avail < GZ_MAX_MATCH) ? avail : GZ_MAX_MATCH;
+                            while ((best < limit) && (a[best] == b[best])) { ++best; }
+                            from = c;
+                        }
+                    }
+                }
+                if (best >= GZ_MIN_MATCH) {
+                    match(best, pos - from);
+                    // index the skipped positions so runs chain together
+                    for (int k = 1; k < best; ++k) {
+                        if (end - (pos + k) >= GZ_MIN_MATCH) {
+                            head[hash(pos + k)] = (uint16_t)(pos + k + 1);
+                        }
+                    }
+                    pos += best;
+                } else {
+                    literal(win[pos - base]);
+                    ++pos;
+                }
+            }
+            break;
+        case GZ_TRAILER: {
+            uint32_t t[2] = { crc, (uint32_t)end };
+            for (int i = 0; i < 8; ++i) {
+                out[outlen++] = t[i / 4] >> (8 * (i % 4));
+            }
+            state = GZ_DONE;
+            break;
+        }
+        case GZ_DONE:
+            break;
+    }
+}
+
+size_t gzipStream::read(uint8_t * buf, size_t len) {
+    size_t n = 0;
+    if (win == NULL) {
+        return 0;
+    }
+    while (n < len) {
+        if (outpos < outlen) {
+            size_t c = min(len - n, outlen - outpos);
+            memcpy(buf + n, out + outpos, c);
+            n += c;
+            outpos += c;
+            continue;
+        }
+        if (state == GZ_DONE) {
+            break;
+        }
+        outlen = outpos = 0;
+        step();
+    }
+    return n;
+}
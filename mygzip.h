@@ -0,0 +1,50 @@
+// small streaming gzip compressor
+// fixed huffman codes and a short LZ77 window, a few KB of state so it can
+// compress large flash regions on the fly while they are being served
+#pragma once
+#include <Arduino.h>
+#include <functional>
+
+// crc32 as used by gzip and zip, pass 0 to start
+extern uint32_t GZ_crc32(uint32_t crc, const uint8_t * data, size_t len);
+
+class gzipStream {
+    public:
+        // fills buf with up to len bytes of input, returns 0 at the end
+        typedef std::function<size_t(uint8_t * buf, size_t len)> source;
+
+        gzipStream(source src);
+        ~gzipStream();
+        // false if the window could not be allocated
+        bool ok() const { return win != NULL; }
+        // copies up to len bytes of compressed output, returns 0 when done
+        size_t read(uint8_t * buf, size_t len);
+        // suitable as the filler for a chunked web response
+        size_t fill(uint8_t * buf, size_t len, size_t) { return read(buf, len); }
+
+    private:
+        void step();
+        void refill();
+        void bits(uint32_t v, int n);
+        void code(uint32_t c, int n);
+        void literal(int c);
+        void match(int len, int dist);
+        uint32_t hash(size_t p) const;
+
+        source src;
+        enum { GZ_HEADER, GZ_DATA, GZ_TRAILER, GZ_DONE } state;
+        uint8_t * win;
+        uint16_t * head;
+        // absolute input offsets of win[0], the next byte to encode and
+        // the end of the data read so far
+        size_t base;
+        size_t pos;
+        size_t end;
+        bool eof;
+        uint32_t crc;
+        uint32_t bitbuf;
+        int nbits;
+        uint8_t out[64];
+        size_t outlen;
+        size_t outpos;
+};
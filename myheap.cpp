@@ -0,0 +1,211 @@
+// per subsystem heap accounting
+// the linker redirects malloc and friends here, each live block is
+// remembered in a fixed pointer table so its free can be charged back
+// to the tag that allocated it
+#if defined(MY_HEAP_ACCOUNTING) && !defined(ESP8266)
+#include <Arduino.h>
+#include <myheap.h>
+
+// must be a power of two, blocks beyond this are counted as untracked
+#ifndef HEAP_TRACK_SLOTS
+#define HEAP_TRACK_SLOTS 1024
+#endif
+// slots looked at per lookup, keeps the time under heap_mux bounded,
+// a block that finds no room this close to home is counted as untracked
+#ifndef HEAP_TRACK_PROBE
+#define HEAP_TRACK_PROBE 8
+#endif
+#define HEAP_SLOT_MASK (HEAP_TRACK_SLOTS - 1)
+
+extern "C" {
+void * __real_malloc(size_t);
+void __real_free(void *);
+void * __real_calloc(size_t, size_t);
+void * __real_realloc(void *, size_t);
+}
+
+static const char * const tag_names[HEAP_TAGS] = {
+    "-", "SYS", "TR", "TF", "CFG", "WEB"
+};
+
+struct heapStats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t bytes;
+    uint32_t live;
+    uint32_t peak;
+};
+static heapStats stats[HEAP_TAGS];
+static uint32_t untracked = 0;
+
+struct heapBlock {
+    void * ptr;
+    uint32_t size : 24;
+    uint32_t tag : 8;
+};
+static heapBlock blocks[HEAP_TRACK_SLOTS];
+
+static portMUX_TYPE heap_mux = portMUX_INITIALIZER_UNLOCKED;
+static __thread uint8_t scope_tag = HEAP_NONE;
+
+uint8_t HEAP_scope_set(uint8_t tag) {
+    uint8_t prev = scope_tag;
+    scope_tag = tag;
+    return prev;
+}
+
+static uint8_t current_tag() {
+    if (xPortInIsrContext() || (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)) {
+        return HEAP_SYS;
+    }
+    if (scope_tag != HEAP_NONE) {
+        return scope_tag;
+    }
+    const char * n = pcTaskGetName(NULL);
+    if (n[0] == 'T' && n[2] == 0) {
+        if (n[1] == 'R') { return HEAP_TR; }
+        if (n[1] == 'F') { return HEAP_TF; }
+    }
+    if (strcmp(n, "async_tcp") == 0) {
+        return HEAP_WEB;
+    }
+    return HEAP_SYS;
+}
+
+static inline uint32_t slot_of(void * p) {
+    return (((uintptr_t)p >> 3) * 2654435761u) & (HEAP_TRACK_SLOTS - 1);
+}
+
+// called with heap_mux held
+static void track(void * p, size_t size, uint8_t tag) {
+    heapStats & s = stats[tag];
+    ++s.allocs;
+    s.bytes += size;
+    uint32_t i = slot_of(p);
+    for (int n = 0; n < HEAP_TRACK_PROBE; ++n, i = (i + 1) & HEAP_SLOT_MASK) {
+        if (blocks[i].ptr == NULL) {
+            blocks[i].ptr = p;
+            blocks[i].size = size;
+            blocks[i].tag = tag;
+            s.live += size;
+            if (s.live > s.peak) {
+                s.peak = s.live;
+            }
+            return;
+        }
+    }
+    // no room near home, its free can't be charged back so leave it out
+    // of live as well
+    ++untracked;
+}
+
+// called with heap_mux held
+static void untrack(void * p) {
+    uint32_t i = slot_of(p);
+    int n;
+    for (n = 0; n < HEAP_TRACK_PROBE; ++n, i = (i + 1) & HEAP_SLOT_MASK) {
+        if (blocks[i].ptr == NULL) {
+            // untracked or allocated by someone else
+            return;
+        }
+        if (blocks[i].ptr == p) {
+            break;
+        }
+    }
+    if (n == HEAP_TRACK_PROBE) {
+        return;
+    }
+    heapStats & s = stats[blocks[i].tag];
+    ++s.frees;
+    s.live -= blocks[i].size;
+    // linear probing, shift later entries back so lookups stay correct
+    // nothing sits more than HEAP_TRACK_PROBE - 1 from home, so entries
+    // that far past the hole can never move into it
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1) & HEAP_SLOT_MASK;
+         (blocks[j].ptr != NULL) && (((j - hole) & HEAP_SLOT_MASK) < HEAP_TRACK_PROBE);
+         j = (j + 1) & HEAP_SLOT_MASK) {
+        uint32_t home = slot_of(blocks[j].ptr);
+        // move j into the hole unless its home lies cyclically in (hole, j]
+        bool stay = (hole <= j) ? (hole < home && home <= j) : (hole < home || home <= j);
+        if (!stay) {
+            blocks[hole] = blocks[j];
+            hole = j;
+        }
+    }
+    blocks[hole].ptr = NULL;
+}
+
+extern "C" {
+void * __wrap_malloc(size_t size) {
+    void * p = __real_malloc(size);
+    if (p) {
+        uint8_t tag = current_tag();
+        portENTER_CRITICAL_SAFE(&heap_mux);
+        track(p, size, tag);
+        portEXIT_CRITICAL_SAFE(&heap_mux);
+    }
+    return p;
+}
+
+void * __wrap_calloc(size_t n, size_t size) {
+    void * p = __real_calloc(n, size);
+    if (p) {
+        uint8_t tag = current_tag();
+        portENTER_CRITICAL_SAFE(&heap_mux);
+        track(p, n * size, tag);
+        portEXIT_CRITICAL_SAFE(&heap_mux);
+    }
+    return p;
+}
+
+void * __wrap_realloc(void * old, size_t size) {
+    void * p = __real_realloc(old, size);
+    if (p || size == 0) {
+        uint8_t tag = current_tag();
+        portENTER_CRITICAL_SAFE(&heap_mux);
+        if (old) {
+            untrack(old);
+        }
+        if (p) {
+            track(p, size, tag);
+        }
+        portEXIT_CRITICAL_SAFE(&heap_mux);
+    }
+    return p;
+}
+
+void __wrap_free(void * p) {
+    if (p) {
+        portENTER_CRITICAL_SAFE(&heap_mux);
+        untrack(p);
+        portEXIT_CRITICAL_SAFE(&heap_mux);
+    }
+    __real_free(p);
+}
+}
+
+void HEAP_status(String & out) {
+    // copy first, building the page allocates
+    heapStats snap[HEAP_TAGS];
+    uint32_t lost;
+    portENTER_CRITICAL(&heap_mux);
+    memcpy(snap, stats, sizeof(snap));
+    lost = untracked;
+    portEXIT_CRITICAL(&heap_mux);
+
+    out += "\n\nHeap by tag  allocs   frees     bytes    live    peak\n";
+    char line[80];
+    for (int t = HEAP_SYS; t < HEAP_TAGS; ++t) {
+        snprintf(line, sizeof(line), "%-10s %8u %7u %9u %7u %7u\n", tag_names[t],
+                 (unsigned)snap[t].allocs, (unsigned)snap[t].frees, (unsigned)snap[t].bytes,
+                 (unsigned)snap[t].live, (unsigned)snap[t].peak);
+        out += line;
+    }
+    if (lost) {
+        out += "Untracked blocks: ";
+        out += String(lost);
+        out += "\n";
+    }
+}
+#endif
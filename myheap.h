@@ -0,0 +1,40 @@
+// per subsystem heap accounting
+// opt in by building with
+//   -DMY_HEAP_ACCOUNTING -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc
+// allocations are tagged by the running task (TR, TF, async_tcp as WEB,
+// anything else SYS) unless a HEAP_SCOPE overrides it
+// ESP32 only, on ESP8266 the macros compile away
+#pragma once
+#include <Arduino.h>
+
+enum heapTag : uint8_t {
+    HEAP_NONE,
+    HEAP_SYS,
+    HEAP_TR,
+    HEAP_TF,
+    HEAP_CFG,
+    HEAP_WEB,
+    HEAP_TAGS
+};
+
+#if defined(MY_HEAP_ACCOUNTING) && !defined(ESP8266)
+// set the tag for this task, returns the previous one
+extern uint8_t HEAP_scope_set(uint8_t tag);
+// append counters to a plain text status page
+extern void HEAP_status(String & out);
+
+class heapScope {
+    public:
+        heapScope(uint8_t tag) : prev(HEAP_scope_set(tag)) {}
+        ~heapScope() { HEAP_scope_set(prev); }
+    private:
+        uint8_t prev;
+};
+
+#define HEAP_CONCAT2(a,b) a##b
+#define HEAP_CONCAT(a,b) HEAP_CONCAT2(a,b)
+#define HEAP_SCOPE(t) heapScope HEAP_CONCAT(heap_scope_, __LINE__)(t)
+#else
+inline void HEAP_status(String &) {}
+#define HEAP_SCOPE(t) do {} while (0)
+#endif
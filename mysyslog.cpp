@@ -1,28 +1,396 @@
 // syslog stuff
+// messages are formatted into a ring buffer by the caller and sent later
+// by a flusher once the network is up, so logging never waits on the
+// network and messages from before SyslogInit or wifi are not lost
 #include <Arduino.h>
 #include "mysyslog.h"
+#include "myconfig.h"
+#include <mywebserver.h>
+#include <mycrc.h>
 #include <my_secrets.h>
 #include <WiFiUdp.h>
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#include <Ticker.h>
+#else
+#include <WiFi.h>
+#endif
+#include <atomic>
+
+/*
+Config nodes:
+        log.<module> = highest severity number sent, 0 (emerg) to 7 (debug)
+            modules are sys cfg wifi time tr tf ota
+
+/logtail shows the messages kept over the last reset and this boot
+*/
+
+// must be a power of two
+#ifndef SYSLOG_RECORDS
+#define SYSLOG_RECORDS 32
+#endif
+#define SYSLOG_MSG_LEN 160
+// how long to hold messages for the clock to be set once networked
+#define SYSLOG_TIME_WAIT 10000
+#define SYSLOG_PORT 514
+// records kept over a reset
+#ifndef LOGTAIL_RECORDS
+#define LOGTAIL_RECORDS 16
+#endif
+#define LOGTAIL_MSG_LEN 96
+#define LOGTAIL_MAGIC 0x10971a11
+
 static WiFiUDP udpClient;
-Syslog *syslog = NULL;
+static char syslog_name[32] = "";
+static bool syslog_started = false;
+
+// one formatted message
+// seq is the usual bounded queue sequence number, a slot is free for
+// position p when seq == p and ready to send when seq == p + 1
+// it is stored less the slot index so the zeroed ring starts out valid
+struct syslogRecord {
+    std::atomic<uint32_t> seq;
+    uint16_t pri;
+    // wall clock when known, else 0 and rebuilt from ms when sent
+    time_t when;
+    uint32_t ms;
+    char msg[SYSLOG_MSG_LEN];
+};
+static syslogRecord records[SYSLOG_RECORDS];
+static std::atomic<uint32_t> head(0);
+// only touched by the flusher
+static uint32_t tail = 0;
+static std::atomic<uint32_t> dropped(0);
+
+#ifdef ESP8266
+static Ticker syslog_ticker;
+#else
+static TaskHandle_t syslog_task = NULL;
+#endif
+
+// the last few messages are mirrored to memory that survives a reset,
+// each record has its own crc so a write torn by a crash is ignored
+struct logTailRecord {
+    uint32_t seq;
+    uint32_t when;
+    uint16_t pri;
+    char msg[LOGTAIL_MSG_LEN];
+    uint32_t crc;
+};
+struct logTail {
+    uint32_t magic;
+    logTailRecord recs[LOGTAIL_RECORDS];
+};
+#ifdef ESP8266
+static logTail log_tail;
+#else
+RTC_NOINIT_ATTR static logTail log_tail;
+#endif
+// what was recovered from before the reset, oldest first
+static logTailRecord last_tail[LOGTAIL_RECORDS];
+static int last_tail_count = 0;
+static std::atomic<uint32_t> tail_seq(0);
+// 0 not started, 1 recovering the previous boot's tail, 2 ready
+static std::atomic<int> tail_state(0);
+
+static uint32_t logtail_crc(const logTailRecord & r) {
+    return CRC_32(&r, offsetof(logTailRecord, crc));
+}
+
+static void logtail_put(uint16_t pri, time_t when, const char * msg) {
+    uint32_t seq = tail_seq.fetch_add(1, std::memory_order_relaxed);
+    logTailRecord & r = log_tail.recs[seq % LOGTAIL_RECORDS];
+    r.seq = seq;
+    r.when = when;
+    r.pri = pri;
+    strncpy(r.msg, msg, sizeof(r.msg) - 1);
+    r.msg[sizeof(r.msg) - 1] = 0;
+    r.crc = logtail_crc(r);
+}
+
+// claim a slot, returns NULL when the ring is full
+// lock free so any number of tasks can log at once
+static syslogRecord * syslog_claim(uint32_t & pos) {
+    pos = head.load(std::memory_order_relaxed);
+    while (1) {
+        uint32_t slot = pos & (SYSLOG_RECORDS - 1);
+        syslogRecord * r = &records[slot];
+        int32_t dif = (int32_t)(r->seq.load(std::memory_order_acquire) + slot - pos);
+        if (dif == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return r;
+            }
+        } else if (dif < 0) {
+            // full, keep the older messages
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+static void syslog_publish(syslogRecord * r, uint32_t pos) {
+    r->seq.store(pos + 1 - (pos & (SYSLOG_RECORDS - 1)), std::memory_order_release);
+#ifndef ESP8266
+    if (syslog_task) {
+        xTaskNotifyGive(syslog_task);
+    }
+#endif
+}
+
+// pick up the tail left by the previous boot and send it on again
+// the first caller from any task does the work, returns false while that
+// is still going on so the others leave the tail alone
+static bool logtail_start() {
+    int expect = 0;
+    if (!tail_state.compare_exchange_strong(expect, 1)) {
+        return expect == 2;
+    }
+    last_tail_count = 0;
+    if (log_tail.magic == LOGTAIL_MAGIC) {
+        for (int i = 0; i < LOGTAIL_RECORDS; ++i) {
+            const logTailRecord & r = log_tail.recs[i];
+            if ((r.crc != logtail_crc(r)) || (r.msg[sizeof(r.msg) - 1] != 0)) {
+                continue;
+            }
+            // insertion sort by sequence
+            int j = last_tail_count++;
+            while ((j > 0) && (last_tail[j - 1].seq > r.seq)) {
+                last_tail[j] = last_tail[j - 1];
+                --j;
+            }
+            last_tail[j] = r;
+        }
+    }
+    memset(&log_tail, 0, sizeof(log_tail));
+    log_tail.magic = LOGTAIL_MAGIC;
+    for (int i = 0; i < last_tail_count; ++i) {
+        uint32_t pos;
+        syslogRecord * r = syslog_claim(pos);
+        if (r == NULL) {
+            break;
+        }
+        r->pri = last_tail[i].pri;
+        // never rebuilt from this boot's clock
+        r->when = last_tail[i].when ? last_tail[i].when : 1;
+        r->ms = 0;
+        snprintf(r->msg, sizeof(r->msg), "prev boot: %s", last_tail[i].msg);
+        syslog_publish(r, pos);
+    }
+    tail_state.store(2);
+    return true;
+}
+
+// format the message and queue it, it goes to the tail even if the
+// ring is full
+static void syslog_put(uint16_t pri, const char * fmt, va_list args) {
+    bool tail = logtail_start();
+    uint32_t pos;
+    syslogRecord * r = syslog_claim(pos);
+    char local[SYSLOG_MSG_LEN];
+    char * msg = r ? r->msg : local;
+    if ((pri & LOG_FACMASK) == 0) {
+        pri |= LOG_DAEMON;
+    }
+    time_t when = time(NULL);
+    if (when < 1000000000) {
+        when = 0;
+    }
+    vsnprintf(msg, SYSLOG_MSG_LEN, fmt, args);
+    if (tail) {
+        logtail_put(pri, when, msg);
+    }
+    if (r == NULL) {
+        return;
+    }
+    r->pri = pri;
+    r->ms = millis();
+    r->when = when;
+    syslog_publish(r, pos);
+}
+
+// rfc3164: <pri>Mmm dd hh:mm:ss host app: msg
+static void syslog_send(uint16_t pri, time_t when, const char * msg) {
+    char ts[20] = "";
+    if (when >= 1000000000) {
+        struct tm tm;
+        localtime_r(&when, &tm);
+        strftime(ts, sizeof(ts), "%b %e %H:%M:%S ", &tm);
+    }
+    udpClient.beginPacket(MY_SYSLOG_SERVER, SYSLOG_PORT);
+    udpClient.printf("<%u>%s%s %s: %s", pri, ts, syslog_name, syslog_name, msg);
+    udpClient.endPacket();
+}
+
+// send whatever is waiting, only ever called from one place at a time
+static void syslog_flush() {
+    static uint32_t net_up_ms = 0;
+    if (!syslog_started || (WiFi.status() != WL_CONNECTED)) {
+        net_up_ms = 0;
+        return;
+    }
+    uint32_t now_ms = millis();
+    if (net_up_ms == 0) {
+        net_up_ms = now_ms | 1;
+    }
+    time_t now = time(NULL);
+    if ((now < 1000000000) && ((now_ms - net_up_ms) < SYSLOG_TIME_WAIT) &&
+        ((head.load(std::memory_order_relaxed) - tail) < (SYSLOG_RECORDS / 2))) {
+        // give the clock a chance so early messages get real timestamps
+        return;
+    }
+    while (1) {
+        uint32_t slot = tail & (SYSLOG_RECORDS - 1);
+        syslogRecord & r = records[slot];
+        if ((r.seq.load(std::memory_order_acquire) + slot) != (tail + 1)) {
+            // empty, or the next one is still being written
+            break;
+        }
+        time_t when = r.when;
+        if ((when == 0) && (now >= 1000000000)) {
+            when = now - (now_ms - r.ms) / 1000;
+        }
+        syslog_send(r.pri, when, r.msg);
+        r.seq.store(tail + SYSLOG_RECORDS - slot, std::memory_order_release);
+        ++tail;
+    }
+    uint32_t d = dropped.exchange(0, std::memory_order_relaxed);
+    if (d) {
+        char msg[40];
+        snprintf(msg, sizeof(msg), "%u syslog messages dropped", (unsigned)d);
+        syslog_send(LOG_DAEMON | LOG_WARNING, (now >= 1000000000) ? now : 0, msg);
+    }
+}
+
+#ifndef ESP8266
+static void syslog_flusher(void *) {
+    while (1) {
+        // woken by new messages, and polled for the network coming up
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        syslog_flush();
+    }
+}
+#endif
+
 // TODO why do these syslogf variants screw up the passed arguments
 // first arg always becomes 26 or 33
 void syslogf(uint16_t pri, const char *fmt, ...) {
-    if (syslog) {
-        va_list args;
-        va_start(args, fmt);
-        syslog->vlogf(pri, fmt, args);
-        va_end(args);
-    }
+    va_list args;
+    va_start(args, fmt);
+    syslog_put(pri, fmt, args);
+    va_end(args);
 }
 void syslogf(const char *fmt, ...) {
-    if (syslog) {
-        va_list args;
-        va_start(args, fmt);
-        syslog->vlogf(LOG_DAEMON, fmt, args);
-        va_end(args);
-    }
+    va_list args;
+    va_start(args, fmt);
+    syslog_put(LOG_DAEMON, fmt, args);
+    va_end(args);
 }
 void SyslogInit(const char * name) {
-    syslog = new Syslog(udpClient, MY_SYSLOG_SERVER, 514, name, name, LOG_DAEMON, SYSLOG_PROTO_BSD);
+    strncpy(syslog_name, name, sizeof(syslog_name) - 1);
+    syslog_started = true;
+#ifdef ESP8266
+    syslog_ticker.attach_ms_scheduled(500, syslog_flush);
+#else
+    xTaskCreate(syslog_flusher, "SL", 4096, NULL, 1, &syslog_task);
+#endif
+}
+
+static const char * const log_modules[LOGM_MAX] = {
+    "sys",
+    "cfg",
+    "wifi",
+    "time",
+    "tr",
+    "tf",
+    "ota",
+};
+// everything but debug until the config says otherwise
+uint8_t log_levels[LOGM_MAX] = {
+    LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO, LOG_INFO,
+};
+
+static int log_module(const String & id) {
+    for (int i = 0; i < LOGM_MAX; ++i) {
+        if (id == log_modules[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const char * handleConfigLevel(const char * name, const String & id, int &value) {
+    int m = log_module(id);
+    if (m == -1) {
+        return "log module not recognised";
+    }
+    if ((value < LOG_EMERG) || (value > LOG_DEBUG)) {
+        return "log level must be 0 to 7";
+    }
+    if (!MyCfgChecking()) {
+        log_levels[m] = value;
+    }
+    return NULL;
+}
+
+static void logtail_json(String & x, const logTailRecord & r) {
+    char b[40];
+    snprintf(b, sizeof(b), "{\"time\":%lu,\"pri\":%u,\"msg\":\"", (unsigned long)r.when, r.pri);
+    x += b;
+    for (const char * p = r.msg; *p; ++p) {
+        if ((*p == '"') || (*p == '\\')) {
+            x += '\\';
+            x += *p;
+        } else if ((uint8_t)*p < ' ') {
+            x += ' ';
+        } else {
+            x += *p;
+        }
+    }
+    x += "\"}";
+}
+
+static void serve_logtail_get(AsyncWebServerRequest * request) {
+    String x;
+    x.reserve((LOGTAIL_RECORDS * 2) * (LOGTAIL_MSG_LEN + 40));
+    x += "{\"previous\":[";
+    for (int i = 0; i < last_tail_count; ++i) {
+        if (i) { x += ','; }
+        logtail_json(x, last_tail[i]);
+    }
+    x += "],\"current\":[";
+    // oldest first, skipping slots not yet written this boot
+    uint32_t end = tail_seq.load(std::memory_order_relaxed);
+    uint32_t start = (end > LOGTAIL_RECORDS) ? end - LOGTAIL_RECORDS : 0;
+    bool first = true;
+    for (uint32_t seq = start; seq < end; ++seq) {
+        logTailRecord r = log_tail.recs[seq % LOGTAIL_RECORDS];
+        if ((r.seq != seq) || (r.crc != logtail_crc(r))) {
+            continue;
+        }
+        if (!first) { x += ','; }
+        first = false;
+        logtail_json(x, r);
+    }
+    x += "]}";
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", x);
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
+void LOG_init() {
+    for (int i = 0; i < LOGM_MAX; ++i) {
+        int l = MyCfgGetInt("log", log_modules[i], log_levels[i]);
+        if ((l >= LOG_EMERG) && (l <= LOG_DEBUG)) {
+            log_levels[i] = l;
+        }
+    }
+    static constexpr MyCfgDesc config[] = {
+        { "log", &handleConfigLevel },
+    };
+    MyCfgRegister(config);
+    logtail_start();
+    server.on("/logtail", HTTP_GET, serve_logtail_get);
 }
@@ -1,5 +1,29 @@
 // syslog stuff
+// messages are queued and sent by a background flusher once the network
+// is up, so syslogf can be called at any time including before SyslogInit
+// the last few messages also survive a reset, they are sent again on the
+// next boot and shown at /logtail
+#pragma once
 #include <Syslog.h>
 extern void syslogf(uint16_t pri, const char *fmt, ...);
 extern void syslogf(const char *fmt, ...);
 extern void SyslogInit(const char * name);
+
+// log level filtering, keep in step with log_modules in mysyslog.cpp
+enum logModule : uint8_t {
+    LOGM_SYS,
+    LOGM_CFG,
+    LOGM_WIFI,
+    LOGM_TIME,
+    LOGM_TR,
+    LOGM_TF,
+    LOGM_OTA,
+    LOGM_MAX
+};
+// least important severity sent per module, set from log.<module>
+extern uint8_t log_levels[LOGM_MAX];
+#define LOG_ENABLED(m, pri) (LOG_PRI(pri) <= log_levels[m])
+// the arguments are not evaluated unless the level is enabled
+#define LOGF(m, pri, ...) do { if (LOG_ENABLED((m), (pri))) { syslogf((pri), __VA_ARGS__); } } while (0)
+// called from SYS_init
+extern void LOG_init();
@@ -5,74 +5,127 @@
 #include "LittleFS.h"
 #include "SPIFFS.h"
 #include <mysyslog.h>
+#include <mytelemetry.h>
+#include <mytrace.h>
+#include <myheap.h>
+#include <myboottime.h>
 #ifdef ESP8266
 #include <Esp.h>
 #else
 #include <esp_system.h>
 #include <esp_core_dump.h>
 #include <esp_partition.h>
-#include <Ticker.h>
-
-// there seems to be issues sometimes where the boot loader will hang if there is an existing
-// core dump present
-// so during boot, if we find a core dump, we copy that to FFS and clear the coredump partition
-// and serve the crash dump from there instead
-// we need a ticker to copy from the coredump partition in the hopes that we have real time
-// available when we do it
-Ticker coredump_save_ticker;
-static void do_coredump_save() {
-    if (time(NULL) < 10000000) {
-        // we do not have time yet, wait a while
-        coredump_save_ticker.once_ms(1000, do_coredump_save);
-        return;
-    }
-    size_t out_addr;
-    size_t out_size;
-    esp_err_t ret = esp_core_dump_image_get(&out_addr, &out_size);
-    esp_partition_iterator_t partition_it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "coredump");
-    if (ret != ESP_OK) {
+
+#include <mygzip.h>
+#include <memory>
+#include <vector>
+
+// the coredump is served straight from the coredump partition, gzipped on
+// the fly, so no filesystem space or extra flash writes are needed
+// it stays in flash until erased with /coredump?erase=true
+static const esp_partition_t * coredump_partition(size_t & size) {
+    size_t addr;
+    if (esp_core_dump_image_get(&addr, &size) != ESP_OK) {
         // no coredump present
-        //Serial.printf("no coredump present\n");
-    } else if (partition_it == NULL) {
-        // no coredump partition present
-        //Serial.printf("no coredump partition present\n");
-    } else {
-        const esp_partition_t * partition = esp_partition_get(partition_it);
-        Serial.printf("Copying coredump size %d to littlefs\n",out_size);
-        // remove any pre-existing coredump
-        LittleFS.remove("/coredump.bin");
-        File file = LittleFS.open("/coredump.bin", FILE_WRITE);
-        if (!file) {
-            // failed to open file for writing
-            syslogf(LOG_DAEMON | LOG_WARNING, "Failed to open coredump file for writing");
-        } else {
-            unsigned char buf[512];
-            out_addr = 0;
-            while (out_size > 0) {
-                size_t toread = min(512U, out_size);
-                esp_err_t e = esp_partition_read(partition, out_addr, buf, toread);
-                if (e != ESP_OK) {
-                    // something broke during read
-                    break;
-                }
-                if (file.write(buf,toread) != toread) {
-                    // something broke during write
-                    syslogf(LOG_DAEMON | LOG_WARNING, "Failed to write to coredump file");
-                    break;
-                }
-                out_size -= toread;
-                out_addr += toread;
+        return NULL;
+    }
+    return esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "coredump");
+}
 
-            }
-            file.close();
-            syslogf(LOG_DAEMON | LOG_WARNING, "Wrote coredump file OK");
-
-            // erase coredump partition
-            esp_err_t z = esp_core_dump_image_erase();
-            //Serial.printf("erased core dump %d\n",z);
-            z = esp_partition_erase_range(partition,0,partition->size);
-            //Serial.printf("erased partition %d\n",z);
+// image_erase only clears the header, wipe the whole partition as well so
+// nothing stale is left behind for the next boot to trip over
+static void coredump_erase() {
+    esp_core_dump_image_erase();
+    const esp_partition_t * partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, "coredump");
+    if (partition) {
+        esp_partition_erase_range(partition, 0, partition->size);
+    }
+}
+
+// the crash as a few short lines, each well inside a syslog message,
+// the backtrace before the registers as it is usually what is wanted
+static bool coredump_summary(std::vector<String> & lines) {
+#ifdef CONFIG_ESP_COREDUMP_DATA_FORMAT_ELF
+    esp_core_dump_summary_t * s = new esp_core_dump_summary_t;
+    if (esp_core_dump_get_summary(s) != ESP_OK) {
+        delete s;
+        return false;
+    }
+    char b[48];
+    String x;
+    snprintf(b, sizeof(b), "task %.16s pc 0x%08x", s->exc_task, (unsigned)s->exc_pc);
+    x += b;
+#ifdef __XTENSA__
+    snprintf(b, sizeof(b), " cause %u vaddr 0x%08x", (unsigned)s->ex_info.exc_cause, (unsigned)s->ex_info.exc_vaddr);
+#else
+    snprintf(b, sizeof(b), " cause %u tval 0x%08x", (unsigned)s->ex_info.mcause, (unsigned)s->ex_info.mtval);
+#endif
+    x += b;
+    snprintf(b, sizeof(b), " elf %.16s", (const char *)s->app_elf_sha256);
+    x += b;
+    lines.push_back(x);
+
+    // eight addresses to a line
+    uint32_t depth = s->exc_bt_info.depth;
+    if (depth > ESP_CORE_DUMP_MAX_BACKTRACE) {
+        depth = ESP_CORE_DUMP_MAX_BACKTRACE;
+    }
+    for (uint32_t i = 0; i < depth; i += 8) {
+        snprintf(b, sizeof(b), "backtrace %u:", (unsigned)i);
+        x = b;
+        for (uint32_t j = i; (j < i + 8) && (j < depth); ++j) {
+            snprintf(b, sizeof(b), " 0x%08x", (unsigned)s->exc_bt_info.bt[j]);
+            x += b;
+        }
+        lines.push_back(x);
+    }
+    if (s->exc_bt_info.corrupted) {
+        lines.push_back("backtrace corrupted");
+    }
+
+#ifdef __XTENSA__
+    for (int i = 0; i < 16; i += 8) {
+        snprintf(b, sizeof(b), "regs a%d-a%d:", i, i + 7);
+        x = b;
+        for (int j = i; j < i + 8; ++j) {
+            snprintf(b, sizeof(b), " %x", (unsigned)s->ex_info.exc_a[j]);
+            x += b;
         }
+        lines.push_back(x);
+    }
+#else
+    snprintf(b, sizeof(b), "regs ra 0x%08x sp 0x%08x", (unsigned)s->ex_info.ra, (unsigned)s->ex_info.sp);
+    lines.push_back(b);
+#endif
+    delete s;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// report any coredump found at boot through syslog, which holds the
+// messages until the network is up and the time is known
+static void do_coredump_report() {
+    size_t size;
+    if (coredump_partition(size) == NULL) {
+        return;
+    }
+    if (esp_core_dump_image_check() != ESP_OK) {
+        // only a complete dump is worth keeping until it is fetched
+        coredump_erase();
+        LOGF(LOGM_SYS, LOG_WARNING, "Coredump size %u corrupt, erased", (unsigned)size);
+        return;
+    }
+    std::vector<String> lines;
+    if (!coredump_summary(lines)) {
+        LOGF(LOGM_SYS, LOG_WARNING, "Coredump present, size %u, no summary", (unsigned)size);
+        return;
+    }
+    LOGF(LOGM_SYS, LOG_WARNING, "Coredump present, size %u, %s", (unsigned)size, lines[0].c_str());
+    for (size_t i = 1; i < lines.size(); ++i) {
+        LOGF(LOGM_SYS, LOG_WARNING, "Coredump %s", lines[i].c_str());
     }
 }
 
@@ -82,12 +135,14 @@ static void do_coredump_save() {
 
 // pip install .
 // PATH=$PATH:../xtensa-esp-elf-gdb/bin/ /c/Users/arepi/AppData/Local/Packages/PythonSoftwareFoundation.Python.3.12_qbz5n2kfra8p0/LocalCache/local-packages/Python312/Scripts/esp-coredump.exe  info_corefile -c ../coredump_test/core.dump ../coredump_test/build/esp32.esp32.esp32/coredump_test.ino.elf
+// gunzip the download first, or fetch it with ?raw
 //
 static void serve_core_get(AsyncWebServerRequest *request) {
-    bool erase = false;
     String x;
     AsyncWebServerResponse *response = nullptr;
-    if (!LittleFS.exists("/coredump.bin")) {
+    size_t size = 0;
+    const esp_partition_t * partition = coredump_partition(size);
+    if (partition == NULL) {
         // likely no coredump present
         x = "no coredump\n";
         response = request->beginResponse(404, "text/plain", x);
@@ -95,34 +150,67 @@ static void serve_core_get(AsyncWebServerRequest *request) {
 
     if ((response == nullptr) && (request->hasParam("erase"))) {
         x = request->getParam("erase")->value();
-        //Serial.printf("erase param %s\n",x.c_str());
         if (x == "true") {
-            //Serial.printf("Wiping coredump\n");
-            LittleFS.remove("/coredump.bin");
+            coredump_erase();
             response = request->beginResponse(200, "text/plain", "Coredump erased");
         } else {
             response = request->beginResponse(200, "text/plain", "Coredump not erased");
         }
     }
 
+    if ((response == nullptr) && (request->hasParam("summary"))) {
+        std::vector<String> lines;
+        if (coredump_summary(lines)) {
+            x = String();
+            for (const String & l : lines) {
+                x += l;
+                x += "\n";
+            }
+            response = request->beginResponse(200, "text/plain", x);
+        } else {
+            response = request->beginResponse(404, "text/plain", "no coredump summary available\n");
+        }
+    }
+
     if (response == nullptr) {
-        // serve coredump
-        File coredump = LittleFS.open("/coredump.bin", FILE_READ);
-        if (!coredump) {
-            // WTF?
-            x = "Failed to open /coredump.bin\n";
-            response = request->beginResponse(404, "text/plain", x);
+        // Content-Disposition: attachment; filename="coredump-xxyyzz.bin"
+        char fakename[80];
+        struct tm timeinfo;
+        time_t now = time(NULL);
+        localtime_r(&now, &timeinfo);
+        bool raw = request->hasParam("raw");
+        strftime(fakename, sizeof(fakename), raw ?
+                 "attachment; filename=\"coredump-%Y%m%d-%H%M%S.bin\"" :
+                 "attachment; filename=\"coredump-%Y%m%d-%H%M%S.bin.gz\"", &timeinfo);
+        if (raw) {
+            response = request->beginResponse("application/octet-stream", size,
+                [partition, size](uint8_t * buf, size_t maxLen, size_t index) -> size_t {
+                size_t n = min(maxLen, size - index);
+                if (esp_partition_read(partition, index, buf, n) != ESP_OK) {
+                    return 0;
+                }
+                return n;
+            });
+            response->addHeader("Content-Disposition", fakename);
         } else {
-            // set multipart filename
-            // Content-Disposition: attachment; filename="coredump-xxyyzz.bin"
-            // coredump.getLastWrite() gives time_t
-            char fakename[60];
-            struct tm timeinfo;
-            //getLocalTime(&timeinfo);
-            time_t filetime = coredump.getLastWrite();
-            localtime_r(&filetime, &timeinfo);
-            strftime(fakename, 60, "/coredump-%Y%m%d-%H%M%S.bin",&timeinfo);
-            response = request->beginResponse(coredump, fakename, "application/octet-stream", true);
+            std::shared_ptr<size_t> offset(new size_t(0));
+            std::shared_ptr<gzipStream> gz(new gzipStream([partition, size, offset](uint8_t * buf, size_t len) -> size_t {
+                size_t n = min(len, size - *offset);
+                if ((n == 0) || (esp_partition_read(partition, *offset, buf, n) != ESP_OK)) {
+                    return 0;
+                }
+                *offset += n;
+                return n;
+            }));
+            if (!gz->ok()) {
+                response = request->beginResponse(500, "text/plain", "Out of memory\n");
+            } else {
+                response = request->beginChunkedResponse("application/gzip",
+                    [gz](uint8_t * buf, size_t maxLen, size_t index) -> size_t {
+                    return gz->read(buf, maxLen);
+                });
+                response->addHeader("Content-Disposition", fakename);
+            }
         }
     }
 
@@ -204,9 +292,9 @@ static void serve_status_get(AsyncWebServerRequest *request) {
     x += "\nFilesystem: ";
     x += filesystem;
 
-    //char b[1024];
-    //vTaskGetRunTimeStats(b);
-    //x += b;
+    BOOT_status(x);
+    TEL_status(x);
+    HEAP_status(x);
     x += "\n</pre></body></html>";
     response = request->beginResponse(200, "text/plain", x);
     response->addHeader("Connection", "close");
@@ -214,6 +302,7 @@ static void serve_status_get(AsyncWebServerRequest *request) {
 }
 
 void SYS_init() {
+    int boot_phase = BOOT_begin("fs");
     if (LittleFS.begin()) {
         // we have a littlefs
         filesystem="littlefs";
@@ -221,16 +310,18 @@ void SYS_init() {
         // we have SPIFFS
         filesystem="spiffs";
     }
+    BOOT_end(boot_phase);
 
 #ifndef ESP8266
+    boot_phase = BOOT_begin("coredump");
     esp_core_dump_init();
     server.on("/coredump",HTTP_GET, serve_core_get);
-
-    if (LittleFS.begin()) {
-        // littlefs filesystem is present, copy any core dump to that
-        do_coredump_save();
-    }
+    do_coredump_report();
+    BOOT_end(boot_phase);
 #endif
+    LOG_init();
+    TEL_init();
+    TRACE_init();
     server.on("/status",HTTP_GET, serve_status_get);
     server.on("/makefs",HTTP_GET, serve_makefs);
 }
@@ -0,0 +1,205 @@
+// system telemetry
+// samples heap fragmentation, per task cpu use and stack headroom on a
+// ticker and keeps a short history, served as json at /telemetry
+#include <Arduino.h>
+#include <mytelemetry.h>
+#include <mywebserver.h>
+#include <Ticker.h>
+#ifdef ESP8266
+#include <Esp.h>
+#else
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#endif
+
+#ifndef TEL_INTERVAL
+#define TEL_INTERVAL 60 // seconds
+#endif
+#ifndef TEL_HISTORY
+#define TEL_HISTORY 10
+#endif
+#ifndef TEL_MAX_TASKS
+#define TEL_MAX_TASKS 24
+#endif
+
+struct tel_sample {
+    time_t when;
+    uint32_t heap_free;
+    uint32_t heap_min;
+    uint32_t heap_largest;
+    // 0-100, how much of the free heap is not in the largest block
+    uint8_t frag;
+    // stack never used by our tasks, bytes
+    uint32_t tr_stack;
+    uint32_t tf_stack;
+};
+static tel_sample history[TEL_HISTORY];
+static int history_next = 0;
+static int history_used = 0;
+
+#ifndef ESP8266
+struct tel_task {
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t number;
+    UBaseType_t prio;
+    BaseType_t core;
+    uint32_t stack_free;
+    uint32_t runtime;
+    // share of one core since the previous sample, tenths of a percent
+    uint16_t cpu;
+};
+static tel_task tasks[TEL_MAX_TASKS];
+static int tasks_used = 0;
+static TaskStatus_t task_status[TEL_MAX_TASKS];
+static uint32_t last_total = 0;
+static SemaphoreHandle_t tel_mutex = NULL;
+#define TEL_LOCK() xSemaphoreTake(tel_mutex, portMAX_DELAY)
+#define TEL_UNLOCK() xSemaphoreGive(tel_mutex)
+#else
+#define TEL_LOCK()
+#define TEL_UNLOCK()
+#endif
+
+static Ticker tel_ticker;
+
+#ifndef ESP8266
+static void sample_tasks(tel_sample & s) {
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(task_status, TEL_MAX_TASKS, &total);
+    uint32_t elapsed = total - last_total;
+    tel_task fresh[TEL_MAX_TASKS];
+    for (UBaseType_t i = 0; i < n; ++i) {
+        const TaskStatus_t & ts = task_status[i];
+        tel_task & t = fresh[i];
+        strncpy(t.name, ts.pcTaskName, sizeof(t.name) - 1);
+        t.name[sizeof(t.name) - 1] = 0;
+        t.number = ts.xTaskNumber;
+        t.prio = ts.uxCurrentPriority;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        t.core = ts.xCoreID;
+#else
+        t.core = -1;
+#endif
+        t.stack_free = ts.usStackHighWaterMark;
+        t.cpu = 0;
+#if configGENERATE_RUN_TIME_STATS
+        t.runtime = ts.ulRunTimeCounter;
+        // compare against the same task last time round
+        for (int j = 0; j < tasks_used; ++j) {
+            if (tasks[j].number == t.number) {
+                if ((elapsed > 0) && (last_total != 0)) {
+                    t.cpu = (uint64_t)(t.runtime - tasks[j].runtime) * 1000 / elapsed;
+                }
+                break;
+            }
+        }
+#else
+        t.runtime = 0;
+#endif
+        if (strcmp(t.name, "TR") == 0) {
+            s.tr_stack = t.stack_free;
+        } else if (strcmp(t.name, "TF") == 0) {
+            s.tf_stack = t.stack_free;
+        }
+    }
+    TEL_LOCK();
+    memcpy(tasks, fresh, n * sizeof(tel_task));
+    tasks_used = n;
+    last_total = total;
+    TEL_UNLOCK();
+}
+#endif
+
+static void tel_sample_now() {
+    tel_sample s;
+    memset(&s, 0, sizeof(s));
+    s.when = time(NULL);
+#ifdef ESP8266
+    s.heap_free = ESP.getFreeHeap();
+    s.heap_min = s.heap_free;
+    s.heap_largest = ESP.getMaxFreeBlockSize();
+    s.frag = ESP.getHeapFragmentation();
+#else
+    s.heap_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    s.heap_min = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    s.heap_largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    s.frag = (s.heap_free > 0) ? 100 - ((uint64_t)s.heap_largest * 100 / s.heap_free) : 0;
+    sample_tasks(s);
+#endif
+    TEL_LOCK();
+    history[history_next] = s;
+    history_next = (history_next + 1) % TEL_HISTORY;
+    if (history_used < TEL_HISTORY) {
+        ++history_used;
+    }
+    TEL_UNLOCK();
+}
+
+static const tel_sample & latest() {
+    return history[(history_next + TEL_HISTORY - 1) % TEL_HISTORY];
+}
+
+void TEL_status(String & out) {
+    TEL_LOCK();
+    if (history_used == 0) {
+        TEL_UNLOCK();
+        return;
+    }
+    const tel_sample & s = latest();
+    out += "\nHeap largest free block: ";
+    out += String(s.heap_largest);
+    out += "\nHeap fragmentation: ";
+    out += String(s.frag);
+    out += "%";
+#ifndef ESP8266
+    out += "\n\nTask             cpu%  stack free\n";
+    for (int i = 0; i < tasks_used; ++i) {
+        char line[60];
+        snprintf(line, sizeof(line), "%-16s %3u.%u  %u\n", tasks[i].name,
+                 tasks[i].cpu / 10, tasks[i].cpu % 10, tasks[i].stack_free);
+        out += line;
+    }
+#endif
+    TEL_UNLOCK();
+}
+
+static void serve_telemetry_get(AsyncWebServerRequest *request) {
+    String x;
+    char b[200];
+    x.reserve(1024);
+    TEL_LOCK();
+    x += "{\"interval\":";
+    x += String(TEL_INTERVAL);
+    x += ",\"tasks\":[";
+#ifndef ESP8266
+    for (int i = 0; i < tasks_used; ++i) {
+        const tel_task & t = tasks[i];
+        snprintf(b, sizeof(b), "%s{\"name\":\"%s\",\"prio\":%u,\"core\":%d,\"cpu\":%u.%u,\"stack_free\":%u}",
+                 i ? "," : "", t.name, (unsigned)t.prio, (int)t.core, t.cpu / 10, t.cpu % 10, (unsigned)t.stack_free);
+        x += b;
+    }
+#endif
+    x += "],\"history\":[";
+    // oldest first
+    for (int i = 0; i < history_used; ++i) {
+        const tel_sample & s = history[(history_next + TEL_HISTORY - history_used + i) % TEL_HISTORY];
+        snprintf(b, sizeof(b), "%s{\"time\":%ld,\"heap_free\":%u,\"heap_min\":%u,\"heap_largest\":%u,\"frag\":%u,\"tr_stack\":%u,\"tf_stack\":%u}",
+                 i ? "," : "", (long)s.when, (unsigned)s.heap_free, (unsigned)s.heap_min, (unsigned)s.heap_largest,
+                 s.frag, (unsigned)s.tr_stack, (unsigned)s.tf_stack);
+        x += b;
+    }
+    x += "]}";
+    TEL_UNLOCK();
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", x);
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
+void TEL_init() {
+#ifndef ESP8266
+    tel_mutex = xSemaphoreCreateMutex();
+#endif
+    tel_sample_now();
+    tel_ticker.attach(TEL_INTERVAL, tel_sample_now);
+    server.on("/telemetry", HTTP_GET, serve_telemetry_get);
+}
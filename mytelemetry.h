@@ -0,0 +1,9 @@
+// system telemetry
+#pragma once
+#include <Arduino.h>
+
+// start sampling, called from SYS_init
+extern void TEL_init();
+
+// append the latest sample to a plain text status page
+extern void TEL_status(String & out);
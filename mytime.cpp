@@ -3,6 +3,7 @@
 // Time setup
 #include <Arduino.h>
 #include "mytime.h"
+#include <mywifi.h>
 
 #ifdef ESP8266
 #include "sntp.h"
@@ -15,9 +16,129 @@
 #include <errno.h>
 #include <string.h>
 #include <my_secrets.h>
+#include <myboottime.h>
+#include <mycrc.h>
+#include <mywebserver.h>
+#include <Ticker.h>
+#ifndef ESP8266
+#include <esp_timer.h>
+#endif
 
 ErriezDS1302 * rtc = NULL;
 static bool have_rtc = false;
+static timeQuality time_quality = TIME_NONE;
+static uint32_t ntp_syncs = 0;
+
+// last known good time, kept across resets so a warm boot can carry on
+// with an estimate until NTP answers
+#define TIME_SAVE_MAGIC 0x71e5a7ed
+// seconds between saves, the most an estimate can be behind
+#define TIME_SAVE_INTERVAL 10
+struct timeSave {
+    uint32_t magic;
+    uint32_t epoch;
+    // cpu clock correction, parts per billion
+    int32_t cpu_ppb;
+    uint32_t crc;
+};
+#ifdef ESP8266
+// offset in RTC user memory in 4 byte blocks, after the wifi cache which
+// itself keeps clear of eboot's area
+#define TIME_RTC_OFFSET WIFI_RTC_END
+#else
+RTC_NOINIT_ATTR static timeSave time_rtc_save;
+#endif
+static Ticker time_save_ticker;
+
+#ifndef ESP8266
+// clock discipline
+// each NTP sync measures how far the system clock wandered since the
+// last one, that feeds a drift estimate which is slewed out a minute at
+// a time so the clock holds between syncs and through NTP outages
+#define TIME_DISCIPLINE_INTERVAL 60
+// syncs closer together than this are mostly network jitter
+#define TIME_MIN_SYNC_GAP 600
+// step rather than slew when further out than this, microseconds
+#define TIME_STEP_OFFSET 1000000
+// the DS1302 only counts seconds, so it is left to drift this far before
+// being rewritten, which also gives a baseline to measure its drift
+#define TIME_RTC_MAX_OFFSET 2
+static Ticker time_discipline_ticker;
+// microseconds of correction per second, positive when the cpu is slow
+static float cpu_ppm = 0;
+static int64_t last_offset_us = 0;
+static uint32_t last_sync_uptime = 0;
+static time_t last_sync = 0;
+static time_t rtc_set_at = 0;
+static int rtc_offset = 0;
+static float rtc_ppm = 0;
+#endif
+
+static uint32_t uptime_s() {
+#ifdef ESP8266
+    return (uint32_t)(micros64() / 1000000);
+#else
+    return (uint32_t)(esp_timer_get_time() / 1000000);
+#endif
+}
+
+static void time_save() {
+    time_t now = time(NULL);
+    if (now < 1000000000) {
+        return;
+    }
+    timeSave t;
+    t.magic = TIME_SAVE_MAGIC;
+    t.epoch = now;
+#ifdef ESP8266
+    t.cpu_ppb = 0;
+#else
+    t.cpu_ppb = cpu_ppm * 1000;
+#endif
+    t.crc = CRC_32(&t, offsetof(timeSave, crc));
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(TIME_RTC_OFFSET, (uint32_t *)&t, sizeof(t));
+#else
+    time_rtc_save = t;
+#endif
+}
+
+static bool time_load(timeSave & t) {
+#ifdef ESP8266
+    if (!ESP.rtcUserMemoryRead(TIME_RTC_OFFSET, (uint32_t *)&t, sizeof(t))) {
+        return false;
+    }
+#else
+    t = time_rtc_save;
+#endif
+    return (t.magic == TIME_SAVE_MAGIC) &&
+           (t.crc == CRC_32(&t, offsetof(timeSave, crc)));
+}
+
+// last saved time plus how long we have been up since the reset
+static time_t time_estimate() {
+    timeSave t;
+    if (!time_load(t)) {
+        return 0;
+    }
+    return t.epoch + uptime_s();
+}
+
+timeQuality TIME_quality() {
+    return time_quality;
+}
+
+uint32_t TIME_ntp_syncs() {
+    return ntp_syncs;
+}
+
+time_t TIME_from_uptime(uint32_t uptime) {
+    return time(NULL) - (uptime_s() - uptime);
+}
+
+uint32_t TIME_uptime() {
+    return uptime_s();
+}
 
 #ifdef ESP8266
 // resync every hour
@@ -26,18 +147,88 @@ uint32_t sntp_update_delay_MS_rfc_not_less_than_15000() { return 60*60*1000; }
 static void timeSyncCallback(bool from_sntp)
 {
     if (from_sntp) {
+        time_quality = TIME_NTP;
+        ++ntp_syncs;
+        time_save();
         // reset the RTC based on NTP
-        rtc->setEpoch(time(NULL));
+        if (have_rtc) {
+            rtc->setEpoch(time(NULL));
+        }
     }
 }
 #else
+// apply the drift estimate, on top of any slew still outstanding
+static void time_discipline() {
+    struct timeval left, delta;
+    if (adjtime(NULL, &left) != 0) {
+        return;
+    }
+    int64_t us = (int64_t)left.tv_sec * 1000000 + left.tv_usec +
+                 (int64_t)(cpu_ppm * TIME_DISCIPLINE_INTERVAL);
+    delta.tv_sec = us / 1000000;
+    delta.tv_usec = us % 1000000;
+    adjtime(&delta, NULL);
+}
+
+// in smooth mode this runs before the slew starts, so the system clock
+// still shows how far it had got on its own
 static void timeSyncCallback(struct timeval *tv)
 {
-    // reset the RTC based on NTP
-    rtc->setEpoch(tv->tv_sec);
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t offset = (int64_t)(tv->tv_sec - now.tv_sec) * 1000000 + (tv->tv_usec - now.tv_usec);
+    uint32_t up = uptime_s();
+    if ((offset >= TIME_STEP_OFFSET) || (offset <= -TIME_STEP_OFFSET)) {
+        // too far to slew, cancel the slew and jump
+        struct timeval zero = { 0, 0 };
+        adjtime(&zero, NULL);
+        settimeofday(tv, NULL);
+    } else if ((time_quality == TIME_NTP) && ((up - last_sync_uptime) >= TIME_MIN_SYNC_GAP)) {
+        // whatever is left is drift not yet accounted for
+        cpu_ppm += 0.5f * offset / (float)(up - last_sync_uptime);
+    }
+    last_offset_us = offset;
+    last_sync_uptime = up;
+    last_sync = tv->tv_sec;
+    time_quality = TIME_NTP;
+    ++ntp_syncs;
+    time_save();
+
+    if (have_rtc) {
+        int off = (int)(rtc->getEpoch() - tv->tv_sec);
+        if (rtc_set_at && (tv->tv_sec - rtc_set_at >= TIME_MIN_SYNC_GAP)) {
+            rtc_ppm = off * 1e6f / (float)(tv->tv_sec - rtc_set_at);
+        }
+        rtc_offset = off;
+        if ((rtc_set_at == 0) || (off >= TIME_RTC_MAX_OFFSET) || (off <= -TIME_RTC_MAX_OFFSET)) {
+            // reset the RTC based on NTP
+            rtc->setEpoch(tv->tv_sec);
+            rtc_set_at = tv->tv_sec;
+        }
+    }
 }
 #endif
 
+static const char * const quality_names[] = { "none", "estimated", "rtc", "ntp" };
+
+static void serve_time_get(AsyncWebServerRequest * request) {
+    char b[320];
+    int n = snprintf(b, sizeof(b), "{\"time\":%lu,\"quality\":\"%s\",\"syncs\":%u",
+                     (unsigned long)time(NULL), quality_names[time_quality], (unsigned)ntp_syncs);
+#ifndef ESP8266
+    n += snprintf(b + n, sizeof(b) - n, ",\"last_sync\":%lu,\"offset_us\":%ld,\"cpu_ppm\":%.3f",
+                  (unsigned long)last_sync, (long)last_offset_us, cpu_ppm);
+    if (have_rtc) {
+        n += snprintf(b + n, sizeof(b) - n, ",\"rtc_offset\":%d,\"rtc_ppm\":%.1f", rtc_offset, rtc_ppm);
+    }
+#endif
+    snprintf(b + n, sizeof(b) - n, "}");
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", b);
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
 void mytime_setup(const char * tz, int pin_clk, int pin_data, int pin_rst)
 {
     setenv("TZ", tz, 1);
@@ -52,6 +243,7 @@ void mytime_setup(const char * tz, int pin_clk, int pin_data, int pin_rst)
         Wire.setClock(100000);
 
         // Initialize RTC
+        int boot_phase = BOOT_begin("rtc");
         int i = 0;
         while (i++ < 3) {
             if (rtc->begin()) {
@@ -60,16 +252,22 @@ void mytime_setup(const char * tz, int pin_clk, int pin_data, int pin_rst)
             }
             delay(1000);
         }
+        BOOT_end(boot_phase);
     }
 
-    if (have_rtc == false) {
-        Serial.println("No RTC!");
-    } else {
 #ifdef ESP8266
-        settimeofday_cb(timeSyncCallback);
+    settimeofday_cb(timeSyncCallback);
 #else
-        sntp_set_time_sync_notification_cb(timeSyncCallback);
+    sntp_set_time_sync_notification_cb(timeSyncCallback);
+    if (time(NULL) >= 1000000000) {
+        // the system clock was kept running over the reset
+        time_quality = TIME_RTC;
+    }
 #endif
+
+    if (have_rtc == false) {
+        Serial.println("No RTC!");
+    } else {
         if (!rtc->isRunning()) {
             // Enable oscillator - time not trustworthy
             Serial.println("RTC is not running yet");
@@ -91,14 +289,39 @@ void mytime_setup(const char * tz, int pin_clk, int pin_data, int pin_rst)
             {
                 Serial.println("Failed to set time from RTC");
                 Serial.println(strerror(errno));
+            } else {
+                time_quality = TIME_RTC;
+            }
+        }
+    }
+
+    if (time_quality == TIME_NONE) {
+        time_t t = time_estimate();
+        if (t) {
+            struct timeval now;
+            now.tv_sec = t;
+            now.tv_usec = 0;
+            if (settimeofday(&now, NULL) == 0) {
+                Serial.println("Time estimated from before the reset");
+                time_quality = TIME_ESTIMATED;
             }
         }
     }
+    time_save_ticker.attach(TIME_SAVE_INTERVAL, time_save);
 
 #ifndef ESP8266
     // resync every hour
-    sntp_set_sync_interval(3600*000);
+    sntp_set_sync_interval(3600*1000);
+    // small corrections are slewed so the clock never jumps
+    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+    timeSave t;
+    if (time_load(t)) {
+        // carry the drift estimate over a warm reset
+        cpu_ppm = t.cpu_ppb / 1000.0f;
+    }
+    time_discipline_ticker.attach(TIME_DISCIPLINE_INTERVAL, time_discipline);
 #endif
+    server.on("/time", HTTP_GET, serve_time_get);
 
     // SNTP gets started when Wifi connects
     configTzTime(tz, MY_NTP_SERVER1, MY_NTP_SERVER2, MY_NTP_SERVER3);
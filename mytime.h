@@ -1,5 +1,27 @@
 //////////////////////////////////////////////////////////////////////////////
 //
 // Time setup
+// time source, drift and offset estimates are served at /time
+#pragma once
+#include <Arduino.h>
 
 extern void mytime_setup(const char * tz, int pin_clk=-1, int pin_data=-1, int pin_rst=-1);
+
+// where the current time came from, in increasing order of trust
+enum timeQuality : uint8_t {
+    // not set, time(NULL) is near 1970
+    TIME_NONE,
+    // last known time from before a reset plus uptime
+    TIME_ESTIMATED,
+    // DS1302, or the system clock kept over a reset
+    TIME_RTC,
+    // synced from NTP this boot
+    TIME_NTP,
+};
+extern timeQuality TIME_quality();
+// counts NTP syncs, so a change shows the clock may have stepped
+extern uint32_t TIME_ntp_syncs();
+// seconds since boot, for stamping samples whose time is provisional
+extern uint32_t TIME_uptime();
+// convert a TIME_uptime() value to the current idea of wall clock time
+extern time_t TIME_from_uptime(uint32_t uptime);
@@ -0,0 +1,143 @@
+// lightweight tracing spans
+// each core writes to its own ring, slots are claimed with an atomic
+// increment so tasks preempting each other on a core never block
+#ifdef MY_TRACE
+#include <Arduino.h>
+#include <mytrace.h>
+#include <mywebserver.h>
+#include <atomic>
+#include <memory>
+
+// per core, must be a power of two
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 256
+#endif
+
+#ifdef ESP8266
+#define TRACE_CORES 1
+#define TRACE_CORE() 0
+#define TRACE_TASK() "loop"
+#else
+#define TRACE_CORES portNUM_PROCESSORS
+#define TRACE_CORE() xPortGetCoreID()
+#define TRACE_TASK() pcTaskGetName(NULL)
+#endif
+
+static const char * const span_names[TRACE_MAX] = {
+    "tr.sensors",
+    "tr.post",
+    "tf.fetch",
+    "cfg.get",
+    "cfg.post",
+    "cfg.export",
+    "cfg.import",
+    "cfg.list",
+};
+
+struct traceEvent {
+    uint32_t us;
+    uint8_t span;
+    char phase;
+    // leading characters of the task name
+    char task[6];
+};
+
+struct traceRing {
+    std::atomic<uint32_t> head;
+    traceEvent events[TRACE_EVENTS];
+};
+static traceRing rings[TRACE_CORES];
+
+// set while /trace is being sent so the rings do not move underneath it
+static std::atomic<bool> paused(false);
+
+void TRACE_record(uint8_t span, char phase) {
+    if (paused.load(std::memory_order_relaxed)) {
+        return;
+    }
+    traceRing & r = rings[TRACE_CORE()];
+    uint32_t slot = r.head.fetch_add(1, std::memory_order_relaxed) & (TRACE_EVENTS - 1);
+    traceEvent & e = r.events[slot];
+    e.us = micros();
+    e.span = span;
+    e.phase = phase;
+    strncpy(e.task, TRACE_TASK(), sizeof(e.task));
+}
+
+static void serve_trace_get(AsyncWebServerRequest * request) {
+    struct state {
+        int core = 0;
+        uint32_t pos = 0;
+        uint32_t end = 0;
+        bool started = false;
+        bool first = true;
+        // task names seen so far, index is the chrome tid
+        char tasks[16][sizeof(traceEvent::task) + 1];
+        int ntasks = 0;
+    };
+    std::shared_ptr<state> st(new state);
+    paused = true;
+    request->onDisconnect([]() { paused = false; });
+
+    // produce the next chunk of json, false when finished
+    AsyncWebServerResponse * response = WS_stream_response(request, "application/json", [st](String & out) -> bool {
+        if (!st->started) {
+            st->started = true;
+            out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            st->core = -1;
+        }
+        while (st->pos == st->end) {
+            if (++st->core >= TRACE_CORES) {
+                out += "]}";
+                paused = false;
+                return false;
+            }
+            uint32_t head = rings[st->core].head.load();
+            st->end = head;
+            st->pos = (head > TRACE_EVENTS) ? head - TRACE_EVENTS : 0;
+        }
+        // a handful of events per chunk keeps the string short
+        char b[160];
+        for (int n = 0; (n < 8) && (st->pos != st->end); ++n, ++st->pos) {
+            const traceEvent & e = rings[st->core].events[st->pos & (TRACE_EVENTS - 1)];
+            if (e.span >= TRACE_MAX) {
+                continue;
+            }
+            char name[sizeof(e.task) + 1];
+            memcpy(name, e.task, sizeof(e.task));
+            name[sizeof(e.task)] = 0;
+            int tid;
+            for (tid = 0; tid < st->ntasks; ++tid) {
+                if (strcmp(st->tasks[tid], name) == 0) {
+                    break;
+                }
+            }
+            if ((tid == st->ntasks) && (tid < 16)) {
+                strcpy(st->tasks[tid], name);
+                ++st->ntasks;
+                snprintf(b, sizeof(b), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                         st->first ? "" : ",", tid, name);
+                out += b;
+                st->first = false;
+            }
+            snprintf(b, sizeof(b), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":0,\"tid\":%d,\"args\":{\"core\":%d}}",
+                     st->first ? "" : ",", span_names[e.span], e.phase, (unsigned)e.us, tid, st->core);
+            out += b;
+            st->first = false;
+        }
+        return true;
+    });
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
+void TRACE_init() {
+    for (int i = 0; i < TRACE_CORES; ++i) {
+        rings[i].head = 0;
+        for (int j = 0; j < TRACE_EVENTS; ++j) {
+            rings[i].events[j].span = TRACE_MAX;
+        }
+    }
+    server.on("/trace", HTTP_GET, serve_trace_get);
+}
+#endif
@@ -0,0 +1,44 @@
+// lightweight tracing spans
+// build with -DMY_TRACE to record spans into a ring buffer served as
+// chrome trace-event json at /trace, without it the macros compile away
+#pragma once
+#include <Arduino.h>
+
+// span ids, keep in step with span_names in mytrace.cpp
+enum traceSpan : uint8_t {
+    TRACE_TR_SENSORS,
+    TRACE_TR_POST,
+    TRACE_TF_FETCH,
+    TRACE_CFG_GET,
+    TRACE_CFG_POST,
+    TRACE_CFG_EXPORT,
+    TRACE_CFG_IMPORT,
+    TRACE_CFG_LIST,
+    TRACE_MAX
+};
+
+#ifdef MY_TRACE
+// called from SYS_init
+extern void TRACE_init();
+extern void TRACE_record(uint8_t span, char phase);
+
+// ends the span when it goes out of scope
+class traceScope {
+    public:
+        traceScope(uint8_t s) : span(s) { TRACE_record(span, 'B'); }
+        ~traceScope() { TRACE_record(span, 'E'); }
+    private:
+        uint8_t span;
+};
+
+#define TRACE_BEGIN(s) TRACE_record((s), 'B')
+#define TRACE_END(s) TRACE_record((s), 'E')
+#define TRACE_CONCAT2(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT2(a,b)
+#define TRACE_SCOPE(s) traceScope TRACE_CONCAT(trace_scope_, __LINE__)(s)
+#else
+inline void TRACE_init() {}
+#define TRACE_BEGIN(s) do {} while (0)
+#define TRACE_END(s) do {} while (0)
+#define TRACE_SCOPE(s) do {} while (0)
+#endif
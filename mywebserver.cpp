@@ -5,8 +5,17 @@
 #include <AsyncTCP.h>
 #endif
 #include "mywebserver.h"
+#include <LittleFS.h>
+#include <memory>
 AsyncWebServer server(80);
 
+// static assets live under /www on LittleFS, ideally pre-compressed as
+// name.gz which is then sent as is with Content-Encoding gzip
+#define STATIC_DIR "/www"
+#ifndef STATIC_MAX_AGE
+#define STATIC_MAX_AGE 604800
+#endif
+
 static const char * default_page = NULL;
 
 AsyncWebServerResponse * redirect_to_root(AsyncWebServerRequest * request, const char *b) {
@@ -15,15 +24,114 @@ AsyncWebServerResponse * redirect_to_root(AsyncWebServerRequest * request, const
   return(response);
 }
 
+AsyncWebServerResponse * WS_stream_response(AsyncWebServerRequest * request, const char * type, WS_source next) {
+  struct state {
+    WS_source next;
+    String pending;
+    size_t offset = 0;
+    bool done = false;
+  };
+  std::shared_ptr<state> st(new state);
+  st->next = next;
+  return request->beginChunkedResponse(type, [st](uint8_t * buf, size_t maxLen, size_t index) -> size_t {
+    size_t n = 0;
+    while (n < maxLen) {
+      if (st->offset >= st->pending.length()) {
+        if (st->done) {
+          break;
+        }
+        st->pending = String();
+        st->offset = 0;
+        st->done = !st->next(st->pending);
+        continue;
+      }
+      size_t c = min(maxLen - n, (size_t)(st->pending.length() - st->offset));
+      memcpy(buf + n, st->pending.c_str() + st->offset, c);
+      n += c;
+      st->offset += c;
+    }
+    return n;
+  });
+}
+
 static void serve_root_get(AsyncWebServerRequest *request) {
   AsyncWebServerResponse *response = request->beginResponse(302, "text/plain", "OK");
   response->addHeader("Location",default_page);
   request->send(response);
 }
 
+static const char * static_type(const String & path) {
+  static const char * const types[][2] = {
+    { ".html", "text/html" }, { ".htm", "text/html" }, { ".css", "text/css" },
+    { ".js", "application/javascript" }, { ".json", "application/json" },
+    { ".png", "image/png" }, { ".jpg", "image/jpeg" }, { ".gif", "image/gif" },
+    { ".svg", "image/svg+xml" }, { ".ico", "image/x-icon" }, { ".txt", "text/plain" },
+  };
+  for (const auto & t : types) {
+    if (path.endsWith(t[0])) {
+      return t[1];
+    }
+  }
+  return "application/octet-stream";
+}
+
+// GET /www/... also matches everything below /www
+static void serve_static_get(AsyncWebServerRequest *request) {
+  String path = request->url();
+  if (path.indexOf("..") >= 0) {
+    request->send(400, "text/plain", "Bad path");
+    return;
+  }
+  if (path == STATIC_DIR) {
+    path += "/";
+  }
+  if (path.endsWith("/")) {
+    path += "index.html";
+  }
+  // prefer the compressed copy unless the client can't take it and there
+  // is a plain one, the etag covers whichever file is actually sent
+  bool accept_gz = request->hasHeader("Accept-Encoding") &&
+                   (request->getHeader("Accept-Encoding")->value().indexOf("gzip") >= 0);
+  String name = path + ".gz";
+  bool gz = LittleFS.exists(name);
+  if (gz && !accept_gz && LittleFS.exists(path)) {
+    gz = false;
+  }
+  if (!gz) {
+    name = path;
+  }
+  File f;
+  if (LittleFS.exists(name)) {
+    f = LittleFS.open(name, "r");
+  }
+  if (!f || f.isDirectory()) {
+    request->send(404, "text/plain", "Not found");
+    return;
+  }
+  char etag[24];
+  snprintf(etag, sizeof(etag), "\"%x-%x\"", (unsigned)f.size(), (unsigned)f.getLastWrite());
+  f.close();
+
+  AsyncWebServerResponse *response;
+  if (request->hasHeader("If-None-Match") && (request->getHeader("If-None-Match")->value() == etag)) {
+    response = request->beginResponse(304);
+  } else {
+    // the type comes from the plain name, the library would look at .gz
+    response = request->beginResponse(LittleFS, name, static_type(path));
+    if (gz) {
+      response->addHeader("Content-Encoding", "gzip");
+    }
+  }
+  response->addHeader("Vary", "Accept-Encoding");
+  response->addHeader("ETag", etag);
+  response->addHeader("Cache-Control", "max-age=" + String(STATIC_MAX_AGE));
+  request->send(response);
+}
+
 void WS_init(const char * d) {
     // Route for root / web page
     default_page = d;
     server.on("/", HTTP_GET, serve_root_get);
+    server.on(STATIC_DIR, HTTP_GET, serve_static_get);
     server.begin();
 }
@@ -1,6 +1,12 @@
 #include <ESPAsyncWebServer.h>
+#include <functional>
 extern AsyncWebServer server;
 extern void WS_init(const char * default_page);
 
 // create redirect back to root page
 extern AsyncWebServerResponse * redirect_to_root(AsyncWebServerRequest * request, const char *b="ok");
+
+// chunked response fed a piece at a time by next(), which appends to the
+// string it is given and returns false once there is nothing more to come
+typedef std::function<bool(String &)> WS_source;
+extern AsyncWebServerResponse * WS_stream_response(AsyncWebServerRequest * request, const char * type, WS_source next);
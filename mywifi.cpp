@@ -4,6 +4,9 @@
 #include <mywifi.h>
 #include <mysyslog.h>
 #include <myconfig.h>
+#include <myboottime.h>
+#include <mycrc.h>
+#include <mywebserver.h>
 #include <Ticker.h>
 #ifdef ESP8266
 #include <Esp.h>
@@ -16,22 +19,587 @@ Config nodes:
         wifi.hostname
         wifi.ssid
         wifi.password
+        wifi.ssidN, wifi.passwordN     further networks, N = 1..3
+        wifiok.N                        successful connects, 0 is wifi.ssid
 */
 
 #ifndef ESP8266
 // ESP32 does not have a separate scheduler queue
 #define once_ms_scheduled once_ms
+#define attach_ms_scheduled attach_ms
 #else
 #define WIFI_AUTH_OPEN AUTH_OPEN
 #endif
 
+// how long a direct connect using the cached AP may take before falling
+// back to a full scan
+#ifndef WIFI_FAST_TIMEOUT
+#define WIFI_FAST_TIMEOUT 5000
+#endif
+
+// credential sets, 0 is wifi.ssid/wifi.password and falls back to the
+// compiled in secrets, the rest are wifi.ssidN/wifi.passwordN
+#define WIFI_MAX_CREDS 4
+// the set in use for the current or last connection
+static int wifi_cred = 0;
+
+// a copy of the sets, the roam ticker runs in the esp_timer task on ESP32
+// and must not wait on the config lock there
+// loaded in WIFI_init and kept up to date by subscription
+struct wifiCred {
+    char ssid[33];
+    char pass[65];
+};
+static wifiCred wifi_creds[WIFI_MAX_CREDS];
+#ifdef ESP8266
+#define WIFI_CRED_LOCK()
+#define WIFI_CRED_UNLOCK()
+#else
+static portMUX_TYPE wifi_cred_mux = portMUX_INITIALIZER_UNLOCKED;
+#define WIFI_CRED_LOCK() portENTER_CRITICAL(&wifi_cred_mux)
+#define WIFI_CRED_UNLOCK() portEXIT_CRITICAL(&wifi_cred_mux)
+#endif
+
+static void wifi_cred_set(int i, bool pass, const String & value) {
+    WIFI_CRED_LOCK();
+    char * d = pass ? wifi_creds[i].pass : wifi_creds[i].ssid;
+    size_t len = pass ? sizeof(wifi_creds[i].pass) : sizeof(wifi_creds[i].ssid);
+    strncpy(d, value.c_str(), len - 1);
+    d[len - 1] = 0;
+    WIFI_CRED_UNLOCK();
+}
+
+static void wifi_creds_load() {
+    wifi_cred_set(0, false, MyCfgGetString("wifi","ssid",MY_WIFI_SSID));
+    wifi_cred_set(0, true, MyCfgGetString("wifi","password",MY_WIFI_PASSWORD));
+    for (int i = 1; i < WIFI_MAX_CREDS; ++i) {
+        wifi_cred_set(i, false, MyCfgGetString("wifi","ssid"+String(i),""));
+        wifi_cred_set(i, true, MyCfgGetString("wifi","password"+String(i),""));
+    }
+}
+
+static bool wifi_credentials(int i, String & ssid, String & pass) {
+    wifiCred c;
+    WIFI_CRED_LOCK();
+    c = wifi_creds[i];
+    WIFI_CRED_UNLOCK();
+    ssid = c.ssid;
+    pass = c.pass;
+    return !ssid.isEmpty();
+}
+
+// successful connects per set, counted here and only written back when
+// the preferred set changes so a flapping link does not wear the flash
+static int wifi_ok[WIFI_MAX_CREDS];
+
+static void wifi_ok_load() {
+    for (int i = 0; i < WIFI_MAX_CREDS; ++i) {
+        wifi_ok[i] = MyCfgGetInt("wifiok",String(i),0);
+    }
+}
+
+// handed to MyCfgDefer, the got IP ticker may not use the config itself
+static void wifi_ok_save() {
+    for (int i = 0; i < WIFI_MAX_CREDS; ++i) {
+        MyCfgPutInt("wifiok",String(i),wifi_ok[i]);
+    }
+}
+
+// the order to try them in, most often successful first then by number
+static void wifi_cred_order(int order[WIFI_MAX_CREDS]) {
+    for (int i = 0; i < WIFI_MAX_CREDS; ++i) {
+        int j = i;
+        while ((j > 0) && (wifi_ok[order[j-1]] < wifi_ok[i])) {
+            order[j] = order[j-1];
+            --j;
+        }
+        order[j] = i;
+    }
+}
+
+// the N from ssidN or passwordN, 0 if not valid
+static int wifi_cred_index(const String & id) {
+    String n = id.substring(id.startsWith("ssid") ? 4 : 8);
+    if ((n.length() != 1) || (n[0] < '1') || (n[0] >= '0' + WIFI_MAX_CREDS)) {
+        return 0;
+    }
+    return n[0] - '0';
+}
+
+// pick a credential set and AP from the first n scan results
+// returns the set or -1 if none of our networks are visible
+static int wifi_choose(int n, int & ap) {
+    int order[WIFI_MAX_CREDS];
+    wifi_cred_order(order);
+    for (int k = 0; k < WIFI_MAX_CREDS; ++k) {
+        String ssid, pass;
+        if (!wifi_credentials(order[k], ssid, pass)) {
+            continue;
+        }
+        ap = -1;
+        for (int i = 0; i < n; ++i) {
+            if ((WiFi.SSID(i) == ssid) && ((ap < 0) || (WiFi.RSSI(i) > WiFi.RSSI(ap)))) {
+                ap = i;
+            }
+        }
+        if (ap >= 0) {
+            return order[k];
+        }
+    }
+    return -1;
+}
+
+// the last good association and lease, kept across resets so that warm
+// boots (OTA, config changes) can skip the scan and DHCP
+// wifiCache itself is in mywifi.h so the next RTC user can go after it
+#ifndef ESP8266
+RTC_NOINIT_ATTR static wifiCache wifi_rtc_cache;
+#endif
+static wifiCache wifi_cache;
+static bool fast_pending = false;
+static bool static_ip = false;
+
+static uint32_t wifi_cache_crc(const wifiCache & c) {
+    return CRC_32(&c, offsetof(wifiCache, crc));
+}
+
+static bool wifi_cache_load() {
+#ifdef ESP8266
+    if (!ESP.rtcUserMemoryRead(WIFI_RTC_OFFSET, (uint32_t *)&wifi_cache, sizeof(wifi_cache))) {
+        return false;
+    }
+#else
+    wifi_cache = wifi_rtc_cache;
+#endif
+    String ssid, pass;
+    return (wifi_cache.crc == wifi_cache_crc(wifi_cache)) &&
+           (wifi_cache.cred < WIFI_MAX_CREDS) && wifi_credentials(wifi_cache.cred, ssid, pass) &&
+           (wifi_cache.ssid_crc == CRC_32(ssid.c_str(), ssid.length())) &&
+           (wifi_cache.ip != 0) && (wifi_cache.channel != 0);
+}
+
+static void wifi_cache_store() {
+    wifi_cache.crc = wifi_cache_crc(wifi_cache);
+#ifdef ESP8266
+    ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t *)&wifi_cache, sizeof(wifi_cache));
+#else
+    wifi_rtc_cache = wifi_cache;
+#endif
+}
+
+static void wifi_cache_clear() {
+    memset(&wifi_cache, 0, sizeof(wifi_cache));
+    wifi_cache_store();
+}
+
+// remember where we are now connected
+static void wifi_cache_save() {
+    String ssid = WiFi.SSID();
+    wifi_cache.ssid_crc = CRC_32(ssid.c_str(), ssid.length());
+    memcpy(wifi_cache.bssid, WiFi.BSSID(), sizeof(wifi_cache.bssid));
+    wifi_cache.channel = WiFi.channel();
+    wifi_cache.cred = wifi_cred;
+    wifi_cache.ip = WiFi.localIP();
+    wifi_cache.gateway = WiFi.gatewayIP();
+    wifi_cache.mask = WiFi.subnetMask();
+    wifi_cache.dns = WiFi.dnsIP();
+    wifi_cache_store();
+}
+
+// back to DHCP after a fast connect used the cached lease
+static void wifi_use_dhcp() {
+    if (static_ip) {
+        static_ip = false;
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+    }
+}
+
+// associate straight to the cached AP on its channel, reusing the lease
+static bool fastConnect() {
+    String wifi_ssid, wifi_pass;
+    if (!wifi_cache_load()) {
+        return false;
+    }
+    wifi_cred = wifi_cache.cred;
+    wifi_credentials(wifi_cred, wifi_ssid, wifi_pass);
+    Serial.printf("Fast connect to %02x:%02x:%02x:%02x:%02x:%02x on channel %d\r\n",
+                  wifi_cache.bssid[0], wifi_cache.bssid[1], wifi_cache.bssid[2],
+                  wifi_cache.bssid[3], wifi_cache.bssid[4], wifi_cache.bssid[5], wifi_cache.channel);
+    WiFi.mode(WIFI_STA);
+    static_ip = WiFi.config(IPAddress(wifi_cache.ip), IPAddress(wifi_cache.gateway),
+                            IPAddress(wifi_cache.mask), IPAddress(wifi_cache.dns));
+    WiFi.begin(wifi_ssid, wifi_pass, wifi_cache.channel, wifi_cache.bssid);
+    fast_pending = true;
+    return true;
+}
+
+// link statistics, a ring of connection events, a ring of rssi samples
+// and running totals, served at /wifistats and added to the TR upload
+#define WIFI_EVENTS 24
+#define WIFI_RSSI_SAMPLES 30
+#ifndef WIFI_RSSI_INTERVAL
+#define WIFI_RSSI_INTERVAL 120 // seconds between rssi samples
+#endif
+
+enum wifiEventType : uint8_t {
+    WE_DISCONNECT,
+    WE_ASSOC,
+    WE_GOTIP,
+    WE_ROAM,
+};
+static const char * const wifi_event_names[] = {
+    "disconnect", "assoc", "gotip", "roam"
+};
+struct wifiEvent {
+    uint32_t when;
+    wifiEventType type;
+    // disconnect reason code
+    uint8_t reason;
+    int8_t rssi;
+    // time taken to associate or get an address
+    uint32_t ms;
+};
+static wifiEvent wifi_events[WIFI_EVENTS];
+static int wifi_events_next = 0;
+static int wifi_events_used = 0;
+
+struct wifiRssi {
+    uint32_t when;
+    int8_t rssi;
+};
+static wifiRssi wifi_rssi[WIFI_RSSI_SAMPLES];
+static int wifi_rssi_next = 0;
+static int wifi_rssi_used = 0;
+static unsigned long wifi_rssi_last = 0;
+
+struct wifiStats {
+    uint32_t disconnects;
+    uint32_t roams;
+    uint32_t outages;
+    uint32_t outage_ms;
+    uint32_t outage_ms_max;
+    uint32_t assoc_n;
+    uint32_t assoc_ms;
+    uint32_t assoc_ms_total;
+    uint32_t assoc_ms_max;
+    uint32_t ip_n;
+    uint32_t ip_ms;
+    uint32_t ip_ms_total;
+    uint32_t ip_ms_max;
+    int32_t rssi_total;
+    uint32_t rssi_n;
+    int8_t rssi_min;
+    int8_t rssi_max;
+    uint8_t last_reason;
+};
+static wifiStats wifi_stats;
+// updated from the ticker handlers, read by the TR task and the web server
+#ifdef ESP8266
+#define WIFI_STATS_LOCK()
+#define WIFI_STATS_UNLOCK()
+#else
+static portMUX_TYPE wifi_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+#define WIFI_STATS_LOCK() portENTER_CRITICAL(&wifi_stats_mux)
+#define WIFI_STATS_UNLOCK() portEXIT_CRITICAL(&wifi_stats_mux)
+#endif
+
+static void wifi_stats_get(wifiStats & s) {
+    WIFI_STATS_LOCK();
+    s = wifi_stats;
+    WIFI_STATS_UNLOCK();
+}
+
+// captured in the event callbacks, consumed by the ticker handlers
+static volatile unsigned long ev_disc_ms = 0;
+static volatile unsigned long ev_conn_ms = 0;
+static volatile unsigned long ev_ip_ms = 0;
+static volatile uint8_t ev_reason = 0;
+// when the current attempt to (re)connect started, 0 while the link is up
+static unsigned long link_down_ms = 0;
+static bool link_seen_up = false;
+
+static void wifi_event_add(wifiEventType type, uint8_t reason, int8_t rssi, uint32_t ms) {
+    wifiEvent & e = wifi_events[wifi_events_next];
+    e.when = time(NULL);
+    e.type = type;
+    e.reason = reason;
+    e.rssi = rssi;
+    e.ms = ms;
+    wifi_events_next = (wifi_events_next + 1) % WIFI_EVENTS;
+    if (wifi_events_used < WIFI_EVENTS) { ++wifi_events_used; }
+}
+
+static void wifi_rssi_sample() {
+    int8_t r = WiFi.RSSI();
+    wifi_rssi[wifi_rssi_next].when = time(NULL);
+    wifi_rssi[wifi_rssi_next].rssi = r;
+    wifi_rssi_next = (wifi_rssi_next + 1) % WIFI_RSSI_SAMPLES;
+    if (wifi_rssi_used < WIFI_RSSI_SAMPLES) { ++wifi_rssi_used; }
+    WIFI_STATS_LOCK();
+    if ((wifi_stats.rssi_n == 0) || (r < wifi_stats.rssi_min)) { wifi_stats.rssi_min = r; }
+    if ((wifi_stats.rssi_n == 0) || (r > wifi_stats.rssi_max)) { wifi_stats.rssi_max = r; }
+    wifi_stats.rssi_total += r;
+    ++wifi_stats.rssi_n;
+    WIFI_STATS_UNLOCK();
+}
+
+int WIFI_influx(char * buf, size_t len, time_t now) {
+    if (WiFi.status() != WL_CONNECTED) {
+        return 0;
+    }
+    // tag values need commas, equals and spaces escaped
+    char host[65];
+    size_t h = 0;
+    for (const char * p = WiFi.getHostname(); p && *p && (h < sizeof(host) - 2); ++p) {
+        if ((*p == ',') || (*p == '=') || (*p == ' ')) {
+            host[h++] = '\\';
+        }
+        host[h++] = *p;
+    }
+    host[h] = 0;
+    wifiStats s;
+    wifi_stats_get(s);
+    int n = snprintf(buf, len, "wifi,t=%s rssi=%di,disconnects=%ui,outages=%ui,outage_ms=%ui,assoc_ms=%ui,ip_ms=%ui,reason=%ui %ld000000000\n",
+                     host, (int)WiFi.RSSI(), (unsigned)s.disconnects, (unsigned)s.outages,
+                     (unsigned)s.outage_ms, (unsigned)s.assoc_ms, (unsigned)s.ip_ms,
+                     (unsigned)s.last_reason, (long)now);
+    return ((n < 0) || ((size_t)n >= len)) ? 0 : n;
+}
+
+static void serve_wifistats_get(AsyncWebServerRequest *request) {
+    String x;
+    char b[160];
+    x.reserve(2048);
+    snprintf(b, sizeof(b), "{\"ssid\":\"%s\",\"bssid\":\"%s\",\"channel\":%d,\"rssi\":%d,",
+             WiFi.SSID().c_str(), WiFi.BSSIDstr().c_str(), (int)WiFi.channel(), (int)WiFi.RSSI());
+    x += b;
+    wifiStats s;
+    wifi_stats_get(s);
+    snprintf(b, sizeof(b), "\"disconnects\":%u,\"last_reason\":%u,\"roams\":%u,\"outages\":%u,\"outage_ms\":%u,\"outage_ms_max\":%u,",
+             (unsigned)s.disconnects, (unsigned)s.last_reason, (unsigned)s.roams, (unsigned)s.outages,
+             (unsigned)s.outage_ms, (unsigned)s.outage_ms_max);
+    x += b;
+    snprintf(b, sizeof(b), "\"assoc_ms\":%u,\"assoc_ms_avg\":%u,\"assoc_ms_max\":%u,\"ip_ms\":%u,\"ip_ms_avg\":%u,\"ip_ms_max\":%u,",
+             (unsigned)s.assoc_ms, (unsigned)(s.assoc_n ? s.assoc_ms_total / s.assoc_n : 0), (unsigned)s.assoc_ms_max,
+             (unsigned)s.ip_ms, (unsigned)(s.ip_n ? s.ip_ms_total / s.ip_n : 0), (unsigned)s.ip_ms_max);
+    x += b;
+    snprintf(b, sizeof(b), "\"rssi_min\":%d,\"rssi_max\":%d,\"rssi_avg\":%d,\"events\":[",
+             s.rssi_min, s.rssi_max, (int)(s.rssi_n ? s.rssi_total / (int32_t)s.rssi_n : 0));
+    x += b;
+    // oldest first
+    for (int i = 0; i < wifi_events_used; ++i) {
+        const wifiEvent & e = wifi_events[(wifi_events_next + WIFI_EVENTS - wifi_events_used + i) % WIFI_EVENTS];
+        snprintf(b, sizeof(b), "%s{\"time\":%u,\"type\":\"%s\",\"reason\":%u,\"rssi\":%d,\"ms\":%u}", i ? "," : "",
+                 (unsigned)e.when, wifi_event_names[e.type], e.reason, e.rssi, (unsigned)e.ms);
+        x += b;
+    }
+    x += "],\"rssi_samples\":[";
+    for (int i = 0; i < wifi_rssi_used; ++i) {
+        const wifiRssi & r = wifi_rssi[(wifi_rssi_next + WIFI_RSSI_SAMPLES - wifi_rssi_used + i) % WIFI_RSSI_SAMPLES];
+        snprintf(b, sizeof(b), "%s[%u,%d]", i ? "," : "", (unsigned)r.when, r.rssi);
+        x += b;
+    }
+    x += "]}";
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", x);
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
+// roaming, scans run in the background from a ticker and the results are
+// kept as a table of APs for our SSID, strongest first
+#ifndef WIFI_ROAM_INTERVAL
+#define WIFI_ROAM_INTERVAL 600 // seconds between routine scans
+#endif
+#ifndef WIFI_ROAM_RSSI
+#define WIFI_ROAM_RSSI -75 // scan early when the link is weaker than this
+#endif
+#ifndef WIFI_ROAM_RSSI_INTERVAL
+#define WIFI_ROAM_RSSI_INTERVAL 60 // seconds between early scans
+#endif
+#ifndef WIFI_ROAM_HYSTERESIS
+#define WIFI_ROAM_HYSTERESIS 8 // dB better before moving
+#endif
+#ifndef WIFI_ROAM_TIMEOUT
+#define WIFI_ROAM_TIMEOUT 15 // seconds to reach the new AP before giving up
+#endif
+#ifndef WIFI_DOWN_RESCAN
+#define WIFI_DOWN_RESCAN 30 // seconds between scans while the link is down
+#endif
+#define WIFI_ROAM_APS 8
+// disconnect reason when we leave an AP ourselves
+#ifdef ESP8266
+#define WIFI_LEAVE_REASON WIFI_DISCONNECT_REASON_ASSOC_LEAVE
+#else
+#define WIFI_LEAVE_REASON WIFI_REASON_ASSOC_LEAVE
+#endif
+
+struct wifiAp {
+    uint8_t bssid[6];
+    uint8_t channel;
+    int8_t rssi;
+};
+static wifiAp roam_aps[WIFI_ROAM_APS];
+static int roam_count = 0;
+static unsigned long roam_last_scan = 0;
+// a blocking scan is running, disconnect events are expected and ignored
+static bool wifi_scanning = false;
+// a background scan is running
+static bool roam_scanning = false;
+// join the best AP when the scan completes rather than compare
+static bool roam_reconnect = false;
+// we asked to move AP, the disconnect from the old one is expected
+static bool roaming = false;
+static unsigned long roaming_ms = 0;
+// no point reconnecting when about to reboot
+static bool going_for_reboot = false;
+Ticker wifi_roam_ticker;
+
+// rebuild the AP table from the first n scan results
+static void roam_rank(int n, const String & ssid) {
+    roam_count = 0;
+    for (int i = 0; i < n; ++i) {
+        if (WiFi.SSID(i) != ssid) {
+            continue;
+        }
+        wifiAp ap;
+        memcpy(ap.bssid, WiFi.BSSID(i), sizeof(ap.bssid));
+        ap.channel = WiFi.channel(i);
+        ap.rssi = WiFi.RSSI(i);
+        // insertion sort, dropping the weakest when full
+        int j = (roam_count < WIFI_ROAM_APS) ? roam_count++ : WIFI_ROAM_APS;
+        while ((j > 0) && (roam_aps[j-1].rssi < ap.rssi)) {
+            if (j < WIFI_ROAM_APS) {
+                roam_aps[j] = roam_aps[j-1];
+            }
+            --j;
+        }
+        if (j < WIFI_ROAM_APS) {
+            roam_aps[j] = ap;
+        }
+    }
+}
+
+static bool roam_start_scan(bool reconnect);
+#ifndef WIFI_RETRY_DELAY
+#define WIFI_RETRY_DELAY 5000
+#endif
+Ticker wifi_retry_ticker;
+static void wifi_retry() {
+    if ((WiFi.status() != WL_CONNECTED) && !roam_start_scan(true)) {
+        wifi_retry_ticker.once_ms_scheduled(WIFI_RETRY_DELAY, wifi_retry);
+    }
+}
+
+static bool roam_start_scan(bool reconnect) {
+    if (roam_scanning) {
+        roam_reconnect |= reconnect;
+        return true;
+    }
+    if (wifi_scanning) {
+        return false;
+    }
+    roam_last_scan = millis();
+    if (WiFi.scanNetworks(true) != WIFI_SCAN_RUNNING) {
+        return false;
+    }
+    roam_scanning = true;
+    roam_reconnect = reconnect;
+    return true;
+}
+
+static void roam_scan_done(int n) {
+    String wifi_ssid, wifi_pass;
+    roam_scanning = false;
+
+    // the link may have dropped while a routine scan was running
+    if (roam_reconnect || ((WiFi.status() != WL_CONNECTED) && !roaming && !going_for_reboot)) {
+        roam_reconnect = false;
+        int ap;
+        int c = wifi_choose(n, ap);
+        if (c >= 0) {
+            wifi_cred = c;
+            wifi_credentials(wifi_cred, wifi_ssid, wifi_pass);
+            roam_rank(n, wifi_ssid);
+            WiFi.begin(wifi_ssid, wifi_pass, roam_aps[0].channel, roam_aps[0].bssid);
+        } else {
+            // none of our networks are about, look again shortly
+            wifi_retry_ticker.once_ms_scheduled(WIFI_RETRY_DELAY, wifi_retry);
+        }
+        WiFi.scanDelete();
+        return;
+    }
+
+    wifi_credentials(wifi_cred, wifi_ssid, wifi_pass);
+    roam_rank(n, wifi_ssid);
+    WiFi.scanDelete();
+
+    if ((WiFi.status() != WL_CONNECTED) || (roam_count == 0)) {
+        return;
+    }
+    int rssi = WiFi.RSSI();
+    if ((memcmp(roam_aps[0].bssid, WiFi.BSSID(), sizeof(roam_aps[0].bssid)) != 0) &&
+        (roam_aps[0].rssi >= rssi + WIFI_ROAM_HYSTERESIS)) {
+        LOGF(LOGM_WIFI, LOG_INFO, "Roaming from %s at %ddBm to %02x:%02x:%02x:%02x:%02x:%02x at %ddBm",
+                WiFi.BSSIDstr().c_str(), rssi,
+                roam_aps[0].bssid[0], roam_aps[0].bssid[1], roam_aps[0].bssid[2],
+                roam_aps[0].bssid[3], roam_aps[0].bssid[4], roam_aps[0].bssid[5], roam_aps[0].rssi);
+        roaming = true;
+        roaming_ms = millis();
+        WIFI_STATS_LOCK();
+        ++wifi_stats.roams;
+        WIFI_STATS_UNLOCK();
+        wifi_event_add(WE_ROAM, 0, roam_aps[0].rssi, 0);
+        WiFi.begin(wifi_ssid, wifi_pass, roam_aps[0].channel, roam_aps[0].bssid);
+    }
+}
+
+// once a second, never blocks
+static void roam_tick() {
+    if (roam_scanning) {
+        int n = WiFi.scanComplete();
+        if (n >= 0) {
+            roam_scan_done(n);
+        } else if (n != WIFI_SCAN_RUNNING) {
+            // scan failed
+            roam_scanning = false;
+            if (roam_reconnect) {
+                roam_reconnect = false;
+                WiFi.reconnect();
+            }
+        }
+        return;
+    }
+    if (roaming && (millis() - roaming_ms >= WIFI_ROAM_TIMEOUT * 1000UL)) {
+        // the old AP never said goodbye or the new one never answered
+        roaming = false;
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+        // auto reconnect is off so nothing else brings the link back, give
+        // each attempt time to finish before looking around again
+        if (!roaming && !fast_pending && !wifi_scanning && !going_for_reboot &&
+            (millis() - roam_last_scan >= WIFI_DOWN_RESCAN * 1000UL)) {
+            roam_start_scan(true);
+        }
+        return;
+    }
+    if (roaming || fast_pending) {
+        return;
+    }
+    if ((wifi_rssi_used == 0) || (millis() - wifi_rssi_last >= WIFI_RSSI_INTERVAL * 1000UL)) {
+        wifi_rssi_last = millis();
+        wifi_rssi_sample();
+    }
+    unsigned long since = (millis() - roam_last_scan) / 1000;
+    if ((since >= WIFI_ROAM_INTERVAL) ||
+        ((since >= WIFI_ROAM_RSSI_INTERVAL) && (WiFi.RSSI() < WIFI_ROAM_RSSI))) {
+        roam_start_scan(false);
+    }
+}
+
 // https://www.esp32.com/viewtopic.php?f=19&t=18979&sid=d768b1ce7fcbc02976e94a404c4c5e9f&start=10
 bool scanAndConnectToStrongestNetwork() {
-    int i_strongest = -1;
-    int32_t rssi_strongest = -100;
-    String wifi_ssid = MyCfgGetString("wifi","ssid",MY_WIFI_SSID);
-    String wifi_pass = MyCfgGetString("wifi","password",MY_WIFI_PASSWORD);
-    Serial.printf("Start scanning for SSID %s\r\n", wifi_ssid);
+    String wifi_ssid, wifi_pass;
+    Serial.printf("Start scanning\r\n");
 
     // TODO what is required here?
     WiFi.mode(WIFI_STA);
@@ -43,7 +611,7 @@ bool scanAndConnectToStrongestNetwork() {
     int n = WiFi.scanNetworks();
     Serial.println("Scan done.");
 
-    if (n == 0) {
+    if (n <= 0) {
         Serial.println("No networks found!");
         return false;
     }
@@ -52,24 +620,23 @@ bool scanAndConnectToStrongestNetwork() {
     for (int i = 0; i < n; ++i) {
         // Print SSID and RSSI for each network found
         Serial.printf("%d: BSSID: %s  %2ddBm, %3d%%  %9s  %s\r\n", i, WiFi.BSSIDstr(i).c_str(), WiFi.RSSI(i), constrain(2 * (WiFi.RSSI(i) + 100), 0, 100), (WiFi.encryptionType(i) == WIFI_AUTH_OPEN) ? "open" : "encrypted", WiFi.SSID(i).c_str());
-        if ((String(wifi_ssid) == String(WiFi.SSID(i)) && (WiFi.RSSI(i)) > rssi_strongest)) {
-            rssi_strongest = WiFi.RSSI(i);
-            i_strongest = i;
-        }
     }
+    roam_last_scan = millis();
 
-    if (i_strongest < 0) {
-        Serial.printf("No network with SSID %s found!\r\n", wifi_ssid);
-#if 0
+    int i_strongest;
+    int c = wifi_choose(n, i_strongest);
+    if (c < 0) {
+        // do not waste a connect timeout on a network that is not there
+        Serial.println("None of our networks found!");
         WiFi.scanDelete();
         return false;
-#else
-        // connect to whatever we can find
-#endif
     }
+    wifi_cred = c;
+    wifi_credentials(wifi_cred, wifi_ssid, wifi_pass);
+    roam_rank(n, wifi_ssid);
 
-    Serial.printf("SSID match found at %d. Connecting...\r\n", i_strongest);
-    WiFi.begin(wifi_ssid, wifi_pass, 0, (i_strongest<0)?NULL:WiFi.BSSID(i_strongest));
+    Serial.printf("SSID %s found at %d. Connecting...\r\n", wifi_ssid.c_str(), i_strongest);
+    WiFi.begin(wifi_ssid, wifi_pass, WiFi.channel(i_strongest), WiFi.BSSID(i_strongest));
     WiFi.scanDelete();
     return true;
 }
@@ -78,6 +645,8 @@ bool scanAndConnectToStrongestNetwork() {
 Ticker wifi_connected_ticker;
 Ticker wifi_disconnected_ticker;
 Ticker wifi_gotip_ticker;
+Ticker wifi_fast_ticker;
+static void wifi_disconnected();
 
 #ifdef ESP8266
 WiFiEventHandler wifiConnectHandler;
@@ -88,13 +657,47 @@ WiFiEventHandler wifiGotIpHandler;
 #endif
 
 static int disconnecttime = 0;
-static bool going_for_reboot = false;
 static bool wifiColdBoot = true;
 
+// the cached AP did not work out, forget it
+// returns false if there is nothing left to do
+static bool wifi_fast_abandon() {
+    if (!fast_pending) { return false; }
+    fast_pending = false;
+    if (WiFi.status() == WL_CONNECTED) { return false; }
+    Serial.println("Fast connect failed, scanning");
+    wifi_cache_clear();
+    wifi_use_dhcp();
+    return true;
+}
+
+// from a ticker or the disconnect event, so scan in the background and
+// join the best AP when the scan completes
+static void wifi_fast_failed() {
+    if (!wifi_fast_abandon()) { return; }
+    // the station must stop trying to connect first or the scan is refused
+    WiFi.disconnect(false);
+    if (!roam_start_scan(true)) {
+        wifi_retry_ticker.once_ms_scheduled(WIFI_RETRY_DELAY, wifi_retry);
+    }
+}
+
 // called from ticker handler and not interrupt thread
 static void wifi_connected() {
+    // a reassociation with no disconnect seen has nothing to time against
+    uint32_t ms = 0;
+    if (link_down_ms != 0) {
+        ms = ev_conn_ms - link_down_ms;
+        WIFI_STATS_LOCK();
+        wifi_stats.assoc_ms = ms;
+        wifi_stats.assoc_ms_total += ms;
+        if (ms > wifi_stats.assoc_ms_max) { wifi_stats.assoc_ms_max = ms; }
+        ++wifi_stats.assoc_n;
+        WIFI_STATS_UNLOCK();
+    }
+    wifi_event_add(WE_ASSOC, 0, WiFi.RSSI(), ms);
     if (disconnecttime != 0) {
-        syslogf("Wifi connected again after %d seconds", time(NULL) - disconnecttime);
+        LOGF(LOGM_WIFI, LOG_NOTICE, "Wifi connected again after %d seconds", time(NULL) - disconnecttime);
         disconnecttime = 0;
     }
 }
@@ -103,6 +706,44 @@ static void wifi_gotip() {
     // at boot there will have been no prior disconnect
     // Init and get the time
     Serial.println(WiFi.localIP());
+    BOOT_network_up();
+    fast_pending = false;
+    roaming = false;
+    wifi_cache_save();
+    {
+        uint32_t ms = ev_ip_ms - ev_conn_ms;
+        WIFI_STATS_LOCK();
+        wifi_stats.ip_ms = ms;
+        wifi_stats.ip_ms_total += ms;
+        if (ms > wifi_stats.ip_ms_max) { wifi_stats.ip_ms_max = ms; }
+        ++wifi_stats.ip_n;
+        WIFI_STATS_UNLOCK();
+        wifi_event_add(WE_GOTIP, 0, WiFi.RSSI(), ms);
+        if (link_down_ms != 0) {
+            // connecting at boot is not an outage
+            if (link_seen_up) {
+                uint32_t down = ev_ip_ms - link_down_ms;
+                WIFI_STATS_LOCK();
+                ++wifi_stats.outages;
+                wifi_stats.outage_ms += down;
+                if (down > wifi_stats.outage_ms_max) { wifi_stats.outage_ms_max = down; }
+                WIFI_STATS_UNLOCK();
+            }
+            link_down_ms = 0;
+        }
+        link_seen_up = true;
+    }
+    // rank this network higher next time round
+    {
+        int order[WIFI_MAX_CREDS];
+        wifi_cred_order(order);
+        int preferred = order[0];
+        ++wifi_ok[wifi_cred];
+        wifi_cred_order(order);
+        if (order[0] != preferred) {
+            MyCfgDefer(wifi_ok_save);
+        }
+    }
     if (wifiColdBoot) {
         String x("started, reason ");
 #ifdef ESP8266
@@ -110,39 +751,65 @@ static void wifi_gotip() {
 #else
         x += String(esp_reset_reason());
 #endif
-        syslogf(LOG_DAEMON | LOG_WARNING, x.c_str());
+        LOGF(LOGM_WIFI, LOG_WARNING, "%s", x.c_str());
     }
 }
 static void wifi_disconnected() {
     // do not try reconnecting if rebooting
     if (going_for_reboot == true) { return; }
 
+    WIFI_STATS_LOCK();
+    ++wifi_stats.disconnects;
+    wifi_stats.last_reason = ev_reason;
+    WIFI_STATS_UNLOCK();
+    wifi_event_add(WE_DISCONNECT, ev_reason, 0, 0);
+    if (link_down_ms == 0) {
+        link_down_ms = ev_disc_ms;
+    }
+
+    if (wifi_scanning) { return; }
+    if (roam_scanning) {
+        // the scan may have been a routine one, join an AP when it is done
+        roam_reconnect = true;
+        return;
+    }
+    if (roaming) {
+        roaming = false;
+        if (ev_reason == WIFI_LEAVE_REASON) {
+            // leaving the old AP, the new one will report in
+            return;
+        }
+        // the new AP would not have us, recover as for any other loss
+    }
+
+    if (fast_pending) {
+        // the cached AP refused us, no point waiting for the timeout
+        wifi_fast_failed();
+        return;
+    }
+
     Serial.println("WiFi lost connection");
     if (disconnecttime == 0) {
         disconnecttime = time(NULL);
     }
-#if 0
-    // TODO fix this when understand correct sequence
-    // always ends up returning -2 from scan request
+    // the cached lease may not be valid any more
+    wifi_use_dhcp();
+    // look around before picking an AP, the station must stop trying to
+    // connect first or the scan is refused (returned -2 before)
     WiFi.disconnect(false);
-    delay(1000);
-    WiFi.begin("lolllool","loooooooool");
-    //WiFi.mode(WIFI_OFF);
-    delay(1000);
-    if (!scanAndConnectToStrongestNetwork()) {
-        // didn't find anything to connect to, try again in a second
-        wifi_disconnected_ticker.once_ms_scheduled(1000,wifi_disconnected);
+    if (!roam_start_scan(true)) {
+        WiFi.reconnect();
     }
-#else
-    WiFi.reconnect();
-#endif
 }
 
 #ifdef ESP8266
 static void WiFiStationDisconnected(const WiFiEventStationModeDisconnected& event){
+    ev_reason = event.reason;
 #else
 static void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info){
+    ev_reason = info.wifi_sta_disconnected.reason;
 #endif
+    ev_disc_ms = millis();
     wifi_disconnected_ticker.once_ms_scheduled(0,wifi_disconnected);
 }
 
@@ -151,7 +818,8 @@ static void WiFiGotIP(const WiFiEventStationModeGotIP& event){
 #else
 static void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info){
 #endif
-    wifi_connected_ticker.once_ms_scheduled(0,wifi_gotip);
+    ev_ip_ms = millis();
+    wifi_gotip_ticker.once_ms_scheduled(0,wifi_gotip);
 }
 
 #ifdef ESP8266
@@ -159,6 +827,7 @@ static void WiFiConnected(const WiFiEventStationModeConnected& event){
 #else
 static void WiFiConnected(WiFiEvent_t event, WiFiEventInfo_t info){
 #endif
+    ev_conn_ms = millis();
     wifi_connected_ticker.once_ms_scheduled(0,wifi_connected);
 }
 
@@ -173,11 +842,44 @@ static const char * handleConfig(const char * name, const String & id, String &v
     } else if (id == "password") {
         // all ok, save the value
         return NULL;
+    } else if ((id.startsWith("ssid") || id.startsWith("password")) &&
+               (wifi_cred_index(id) > 0)) {
+        // further networks
+        return NULL;
     } else {
         return "config type not recognised";
     }
 }
 
+// a set was changed, takes effect at the next (re)connect
+static void wifiCredChanged(const char * name, const String & id, const String & value) {
+    bool pass = id.startsWith("password");
+    if (!pass && !id.startsWith("ssid")) {
+        return;
+    }
+    if ((id == "ssid") || (id == "password")) {
+        wifi_cred_set(0, pass, value);
+    } else {
+        int i = wifi_cred_index(id);
+        if (i > 0) {
+            wifi_cred_set(i, pass, value);
+        }
+    }
+}
+
+static const char * handleConfigOk(const char * name, const String & id, int &value) {
+    if ((id.length() != 1) || (id[0] < '0') || (id[0] >= '0' + WIFI_MAX_CREDS)) {
+        return "Invalid index";
+    }
+    if (value < 0) {
+        return "Invalid count";
+    }
+    if (!MyCfgChecking()) {
+        wifi_ok[id[0] - '0'] = value;
+    }
+    return NULL;
+}
+
 void WIFI_init(const char * hostname, bool wait_for_wifi, bool isColdBoot) {
     wifiColdBoot = isColdBoot;
     String h = MyCfgGetString("wifi","hostname",String(hostname?hostname:""));
@@ -185,10 +887,12 @@ void WIFI_init(const char * hostname, bool wait_for_wifi, bool isColdBoot) {
         WiFi.setHostname(h.c_str());
     }
     disconnecttime = time(NULL);
-    if (!scanAndConnectToStrongestNetwork()) {
-        // didn't find anything to connect to, try again in a second
-        wifi_disconnected_ticker.once_ms_scheduled(1000,wifi_disconnected);
-    }
+    link_down_ms = millis();
+    wifi_ok_load();
+    wifi_creds_load();
+    // the driver must not reconnect behind our back, we pick the AP
+    WiFi.setAutoReconnect(false);
+    // the fast path may complete while we are still in here
 #ifdef ESP8266
     wifiGotIpHandler = WiFi.onStationModeGotIP(WiFiGotIP);
     wifiConnectHandler = WiFi.onStationModeConnected(WiFiConnected);
@@ -198,13 +902,51 @@ void WIFI_init(const char * hostname, bool wait_for_wifi, bool isColdBoot) {
     WiFi.onEvent(WiFiGotIP, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
     WiFi.onEvent(WiFiConnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
 #endif
+    int boot_phase;
+    if (fastConnect()) {
+        boot_phase = BOOT_begin("wifi.fast");
+        if (wait_for_wifi) {
+            // tickers may not get to run while we block below
+            unsigned long start = millis();
+            while ((WiFi.status() != WL_CONNECTED) && (millis() - start < WIFI_FAST_TIMEOUT)) {
+                delay(50);
+            }
+            // nothing would complete a background scan, do it the slow way
+            if (wifi_fast_abandon()) {
+                // the disconnect event must not start a reconnect under the scan
+                wifi_scanning = true;
+                WiFi.disconnect();
+                bool found = scanAndConnectToStrongestNetwork();
+                wifi_scanning = false;
+                if (!found) {
+                    // didn't find anything to connect to, try again in a second
+                    wifi_disconnected_ticker.once_ms_scheduled(1000,wifi_disconnected);
+                }
+            }
+        } else {
+            wifi_fast_ticker.once_ms_scheduled(WIFI_FAST_TIMEOUT, wifi_fast_failed);
+        }
+    } else {
+        boot_phase = BOOT_begin("wifi.scan");
+        if (!scanAndConnectToStrongestNetwork()) {
+            // didn't find anything to connect to, try again in a second
+            wifi_disconnected_ticker.once_ms_scheduled(1000,wifi_disconnected);
+        }
+    }
+    BOOT_end(boot_phase);
     MyCfgRegisterString("wifi",&handleConfig);
+    MyCfgRegisterInt("wifiok",&handleConfigOk);
+    MyCfgSubscribeString("wifi.",&wifiCredChanged);
+    server.on("/wifistats", HTTP_GET, serve_wifistats_get);
+    wifi_roam_ticker.attach_ms_scheduled(1000, roam_tick);
     if (wait_for_wifi) {
         Serial.print("Connecting");
+        boot_phase = BOOT_begin("wifi.wait");
         while (WiFi.status() != WL_CONNECTED) {
             delay(500);
             Serial.print(".");
         }
+        BOOT_end(boot_phase);
     }
     Serial.println(WiFi.localIP());
 }
@@ -5,5 +5,28 @@
 #else
 #include <WiFi.h>
 #endif
+
+// the last good association and lease, kept in RTC memory
+struct wifiCache {
+    uint32_t ssid_crc;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t cred;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t mask;
+    uint32_t dns;
+    // over everything above
+    uint32_t crc;
+};
+#ifdef ESP8266
+// offsets in RTC user memory are in 4 byte blocks, 0-31 hold eboot's OTA
+// command and must be left alone, so the wifi cache starts at 32
+#define WIFI_RTC_OFFSET 32
+// first free block after the wifi cache
+#define WIFI_RTC_END (WIFI_RTC_OFFSET + (sizeof(wifiCache) + 3) / 4)
+#endif
 extern void WIFI_init(const char * hostname = NULL, bool wait_for_wifi = false, bool isColdBoot = true);
 extern void WIFI_going_for_reboot();
+// append link statistics as an influx line, returns the length written
+extern int WIFI_influx(char * buf, size_t len, time_t now);
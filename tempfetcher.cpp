@@ -3,6 +3,8 @@
 #include <my_secrets.h>
 #include <mysyslog.h>
 #include "myconfig.h"
+#include <mytrace.h>
+#include <myboottime.h>
 #ifdef ESP8266
 #include <Ticker.h>
 #include <WiFiClientSecureBearSSL.h>
@@ -14,15 +16,20 @@
 #define SECURE_CLIENT WiFiClientSecure
 #endif
 #include <ArduinoStreamParser.h>
-#include "JsonHandler.h"
+#include "forecastparser.h"
 
 // TODO fix ESP8266 mode to have a ticker called from loop
 
 /*
 Config nodes:
-        fcst.rate (hours)
+        fcst.rate (minutes)
         fcst.ahead (hours)
-        weather.url
+        fcst.behind (hours)
+        weather.url (first location)
+        weather.urlN (further locations, N = 1..max_locations-1)
+        fcstvar.N = label location variable from to reducer
+            e.g. "wind 0 wind_speed_10m 0 12 max"
+            from/to are hours relative to now, reducer is min|max|mean|sum
 */
 
 // how frequently we take readings
@@ -34,7 +41,11 @@ static int forecast_lookbehind = 6; // hours
 // https://api.open-meteo.com/v1/forecast?latitude=50.50000&longitude=-1.000000&hourly=temperature_2m&timezone=GMT&timeformat=unixtime&past_days=0&forecast_days=2
 // look for .hourly.time[] > now and up to e.g. 6 hours ahead
 // pick lowest matching .hourly.temperature_2m[]
-String weather_url = "https://api.open-meteo.com/v1/forecast?latitude=" MY_LATITUDE "&longitude=" MY_LONGDITUDE "&hourly=temperature_2m&timezone=GMT&timeformat=unixtime&past_days=1&forecast_days=2";
+// any further variables needed by fcstvar entries are added to the hourly= list
+static const int max_locations = 2;
+static String weather_url[max_locations] = {
+    "https://api.open-meteo.com/v1/forecast?latitude=" MY_LATITUDE "&longitude=" MY_LONGDITUDE "&hourly=temperature_2m&timezone=GMT&timeformat=unixtime&past_days=1&forecast_days=2",
+};
 
 int forecast_low_temp = 10;
 int historic_low_temp = 10;
@@ -43,143 +54,140 @@ time_t temp_fetch_time = 0;
 static TaskHandle_t fetchtask_handle = NULL;
 #endif
 
-class tempMatcher {
-    private:
-        int min_index = 999;
-        int max_index = -1;
-        float lowest_temp = 999.0;
-        int earliest = 0;
-        int latest = 0;
-        bool saw_value = false;
-    public:
-        tempMatcher() {}
-        void reset(time_t from, time_t to) {
-            earliest = from;
-            latest = to;
-            min_index = 999;
-            max_index = -1;
-            lowest_temp = 999.0;
-            saw_value = false;
-        }
-        bool getTemp(int &temp) {
-            // do not persist the lowest value we saw if we
-            // didn't actually see one
-            if (saw_value) {
-                temp = round(lowest_temp);
-            }
-            return saw_value;
-        }
-        void processTime(int i, int x) {
-            if ((x >= earliest) && (min_index == 999)) {
-                min_index = i;
-            }
-            if (x <= latest) {
-                max_index = i;
-            }
-        }
-        void processValue(int i, float x) {
-            if ((i >= min_index) &&
-                (i <= max_index) &&
-                (x < lowest_temp)) {
-                lowest_temp = x;
-                saw_value = true;
-            }
-        }
-};
+// slots 0 and 1 are the built in forecast and historic low temperatures
+// the remainder come from fcstvar.N
+static const int builtin_vars = 2;
+static const int max_vars = 8;
+static forecastVar forecast_vars[max_vars];
+// bumped whenever the table or a url changes
+static uint32_t vars_gen = 0;
 
-class WeatherForecast: public JsonHandler {
+#ifndef ESP8266
+// the table and urls are changed from the config handlers while the TF
+// task fetches, the task works on a copy taken under the lock
+static SemaphoreHandle_t tf_mutex = NULL;
+#define TF_LOCK() if (tf_mutex) { xSemaphoreTake(tf_mutex, portMAX_DELAY); }
+#define TF_UNLOCK() if (tf_mutex) { xSemaphoreGive(tf_mutex); }
+#else
+#define TF_LOCK()
+#define TF_UNLOCK()
+#endif
 
-    private:
-        bool in_times = false;
-        bool in_temps = false;
-        tempMatcher forecast;
-        tempMatcher historic;
-        bool finished = false;
-        time_t now = 0;
+static void init_builtin_vars() {
+    forecast_vars[0].label = "low";
+    forecast_vars[0].variable = "temperature_2m";
+    forecast_vars[0].from = 0;
+    forecast_vars[0].to = forecast_lookahead;
+    forecast_vars[1].label = "histlow";
+    forecast_vars[1].variable = "temperature_2m";
+    forecast_vars[1].from = -forecast_lookbehind;
+    forecast_vars[1].to = 0;
+}
 
-    public:
-        WeatherForecast() {
-            now = time(NULL);
+// make sure the url for a location asks for every variable we extract from it
+static String build_url(const String & base, int loc, const forecastVar * vars) {
+    String url = base;
+    int start = url.indexOf("hourly=");
+    if (start == -1) {
+        // nothing asked for yet, start an empty list to add to
+        url += (url.indexOf('?') == -1) ? "?hourly=" : "&hourly=";
+        start = url.length();
+    } else {
+        start += 7;
+    }
+    for (int i = 0; i < max_vars; ++i) {
+        const forecastVar & v = vars[i];
+        if (v.location != loc || v.variable.isEmpty()) {
+            continue;
         }
-
-        virtual void startDocument() {
-            forecast.reset(now, now + (forecast_lookahead*3600));
-            historic.reset(now - (forecast_lookbehind*3600), now);
-        };
-
-        virtual void startArray(ElementPath path) {
-            char fullPath[200] = "";	
-            path.toString(fullPath);
-            if (strcmp(fullPath,"hourly.time") == 0) {
-                in_times = true;
-            } else if (strcmp(fullPath,"hourly.temperature_2m") == 0) {
-                in_temps = true;
-            }
-        };
-
-        virtual void startObject(ElementPath path) { };
-
-        virtual void endArray(ElementPath path) {
-            in_times = false;
-            in_temps = false;
-        };
-
-        virtual void endObject(ElementPath path) { };
-
-        virtual void endDocument() {
-            // copy lowest temp to exported value
-            finished = false;
-            finished |= forecast.getTemp(forecast_low_temp);
-            finished |= historic.getTemp(historic_low_temp);
-            if (!finished) {
-                syslogf("No useful temperatures seen!");
-            } else {
-                temp_fetch_time = now;
-            }
-        };
-
-        bool status() const {
-            return finished;
+        int end = url.indexOf('&', start);
+        if (end == -1) { end = url.length(); }
+        String list = "," + url.substring(start, end) + ",";
+        if (list.indexOf("," + v.variable + ",") == -1) {
+            url = url.substring(0, end) + ((end > start) ? "," : "") + v.variable + url.substring(end);
         }
+    }
+    return url;
+}
 
-        virtual void value(ElementPath path, ElementValue value) {
-            if (in_times) {
-                int i = path.getIndex();
-                int x = value.getInt();
-                forecast.processTime(i,x);
-                historic.processTime(i,x);
-            } else if (in_temps) {
-                int i = path.getIndex();
-                float x = value.getFloat();
-                forecast.processValue(i,x);
-                historic.processValue(i,x);
-            }
-        };
-
-        virtual void whitespace(char c) {};
-};
-
-// go and read the forecast temperature
+// go and read the forecast for every location
+// all locations are fetched back to back over the one connection
 static bool TF_get_forecast()
 {
+    TRACE_SCOPE(TRACE_TF_FETCH);
     bool ret = false;
+    time_t now = time(NULL);
+    // parse into a copy so that config changes never race the parser
+    static forecastVar vars[max_vars];
+    String urls[max_locations];
+    TF_LOCK();
+    uint32_t gen = vars_gen;
+    for (int i = 0; i < max_vars; ++i) {
+        vars[i] = forecast_vars[i];
+    }
+    for (int loc = 0; loc < max_locations; ++loc) {
+        urls[loc] = weather_url[loc];
+    }
+    TF_UNLOCK();
     HTTPClient http;
     std::unique_ptr<SECURE_CLIENT>client(new SECURE_CLIENT);
     client->setInsecure();
-    ArudinoStreamParser parser;
-    WeatherForecast custom_handler;
-    parser.setHandler(&custom_handler);
-    http.begin(*client, weather_url);
-    http.useHTTP10();
-    int httpCode = http.GET();
-    if (httpCode == HTTP_CODE_OK)
-    {
-        http.writeToStream(&parser);
-        ret = custom_handler.status();
-    } else {
-        syslogf("Failed to retrieve forecast, status %d",httpCode);
+    // keep-alive so that subsequent locations reuse the TLS session
+    // (writeToStream copes with the chunked encoding this brings)
+    http.setReuse(true);
+    for (int loc = 0; loc < max_locations; ++loc) {
+        if (urls[loc].isEmpty()) {
+            continue;
+        }
+        ArudinoStreamParser parser;
+        WeatherForecast custom_handler(vars, max_vars, loc, now);
+        parser.setHandler(&custom_handler);
+        http.begin(*client, build_url(urls[loc], loc, vars));
+        int httpCode = http.GET();
+        if (httpCode == HTTP_CODE_OK)
+        {
+            http.writeToStream(&parser);
+            if (custom_handler.status()) {
+                temp_fetch_time = now;
+                ret = true;
+            } else {
+                LOGF(LOGM_TF, LOG_WARNING, "No useful forecast values seen for location %d!", loc);
+            }
+            if (loc == 0) {
+                // copy lowest temps to exported values
+                vars[0].matcher.getTemp(forecast_low_temp);
+                vars[1].matcher.getTemp(historic_low_temp);
+            }
+        } else {
+            LOGF(LOGM_TF, LOG_ERR, "Failed to retrieve forecast for location %d, status %d",loc,httpCode);
+        }
+        http.end();
+    }
+    TF_LOCK();
+    // if the config changed meanwhile the values are stale, and the change
+    // has already asked for another fetch
+    if (gen == vars_gen) {
+        for (int i = 0; i < max_vars; ++i) {
+            forecast_vars[i].matcher = vars[i].matcher;
+            forecast_vars[i].value = vars[i].value;
+            forecast_vars[i].valid = vars[i].valid;
+        }
+    }
+    TF_UNLOCK();
+    return ret;
+}
+
+bool TF_get(const String & label, float & value) {
+    bool ret = false;
+    TF_LOCK();
+    for (int i = 0; i < max_vars; ++i) {
+        if (forecast_vars[i].valid && forecast_vars[i].label == label) {
+            value = forecast_vars[i].value;
+            ret = true;
+            break;
+        }
     }
-    http.end();
+    TF_UNLOCK();
     return ret;
 }
 
@@ -203,11 +211,18 @@ static void TF_reporting_task(void *)
     time_t last = 0;
     bool ret;
     // wait a while for networking
+    int boot_phase = BOOT_begin("tf.delay");
     delay(15000);
+    BOOT_end(boot_phase);
+    static bool first_done = false;
     int waittime;
 
     while (1) {
         ret = TF_get_forecast();
+        if (ret && !first_done) {
+            BOOT_mark("tf.first");
+            first_done = true;
+        }
         time_t now = time(NULL);
         waittime = 0;
         if (ret) {
@@ -234,45 +249,159 @@ static void TF_reporting_task(void *)
 }
 #endif
 
+// config changed so retrieve the forecast again
+// called once the change has been committed
+static void refetch() {
+#ifdef ESP8266
+    schedule_get_forecast(1);
+#else
+    if (fetchtask_handle) {
+        xTaskNotifyGive( fetchtask_handle );
+    }
+#endif
+}
+
+static void refetchInt(const char * name, const String & id, int value) {
+    refetch();
+}
+
+static void refetchString(const char * name, const String & id, const String & value) {
+    refetch();
+}
+
 static const char * handleConfigInt(const char * name, const String & id, int &value) {
     const char * ret = NULL;
+    bool apply = !MyCfgChecking();
     if (id == "rate") {
         // all ok, save the value (input is minutes, save as seconds)
-        interval_sample = value;
+        if (apply) {
+            interval_sample = value;
+        }
     } else if (id == "ahead") {
         // all ok, save the value
-        forecast_lookahead = value;
+        if (apply) {
+            forecast_lookahead = value;
+            TF_LOCK();
+            forecast_vars[0].to = value;
+            ++vars_gen;
+            TF_UNLOCK();
+        }
     } else if (id == "behind") {
         // all ok, save the value
-        forecast_lookbehind = value;
+        if (apply) {
+            forecast_lookbehind = value;
+            TF_LOCK();
+            forecast_vars[1].from = -value;
+            ++vars_gen;
+            TF_UNLOCK();
+        }
     } else {
         ret = "forecast value not recognised";
     }
-    if (ret == NULL) {
-        // config changed so retrieve temperatures again
-#ifdef ESP8266
-        schedule_get_forecast(1);
-#else
-        xTaskNotifyGive( fetchtask_handle );
-#endif
-    }
     return ret;
 }
 
-static const char * handleConfigUrl(const char * name, const String & id, String &value) {
+// url for location 0 is weather.url, others are weather.urlN
+static int url_location(const String & id) {
     if (id == "url") {
-        weather_url = value;
-        return NULL;
-    } else {
+        return 0;
+    }
+    if (id.startsWith("url") && id.length() == 4) {
+        int loc = id[3] - '0';
+        if ((loc > 0) && (loc < max_locations)) {
+            return loc;
+        }
+    }
+    return -1;
+}
+
+static const char * handleConfigUrl(const char * name, const String & id, String &value) {
+    int loc = url_location(id);
+    if (loc == -1) {
         return "weather url not recognised";
     }
+    if (!MyCfgChecking()) {
+        TF_LOCK();
+        weather_url[loc] = value;
+        ++vars_gen;
+        TF_UNLOCK();
+    }
+    return NULL;
+}
+
+// parse "label location variable from to reducer" into a slot
+// an empty value clears the slot
+// nothing is changed while config is only being checked
+static const char * loadVar(int slot, const String & value) {
+    forecastVar & v = forecast_vars[slot];
+    if (value.isEmpty()) {
+        if (MyCfgChecking()) {
+            return NULL;
+        }
+        TF_LOCK();
+        v.label = "";
+        v.variable = "";
+        v.valid = false;
+        ++vars_gen;
+        TF_UNLOCK();
+        return NULL;
+    }
+    char label[16], variable[32], reducer[8];
+    int loc, from, to;
+    if (sscanf(value.c_str(), "%15s %d %31s %d %d %7s", label, &loc, variable, &from, &to, reducer) != 6) {
+        return "expected: label location variable from to reducer";
+    }
+    if ((loc < 0) || (loc >= max_locations)) {
+        return "invalid location";
+    }
+    fcstReducer r;
+    if (strcmp(reducer,"min") == 0) { r = FR_MIN; }
+    else if (strcmp(reducer,"max") == 0) { r = FR_MAX; }
+    else if (strcmp(reducer,"mean") == 0) { r = FR_MEAN; }
+    else if (strcmp(reducer,"sum") == 0) { r = FR_SUM; }
+    else { return "reducer must be min, max, mean or sum"; }
+    if (MyCfgChecking()) {
+        return NULL;
+    }
+    TF_LOCK();
+    v.label = label;
+    v.location = loc;
+    v.variable = variable;
+    v.from = from;
+    v.to = to;
+    v.matcher.setReducer(r);
+    v.valid = false;
+    ++vars_gen;
+    TF_UNLOCK();
+    return NULL;
+}
+
+static const char * handleConfigVar(const char * name, const String & id, String &value) {
+    int i = id.toInt();
+    if ((id != String(i)) || (i < 0) || (i >= (max_vars - builtin_vars))) {
+        return "Invalid index";
+    }
+    return loadVar(builtin_vars + i, value);
 }
 
 void TF_init() {
+#ifndef ESP8266
+    tf_mutex = xSemaphoreCreateMutex();
+#endif
     interval_sample = MyCfgGetInt("fcst","rate",interval_sample);
     forecast_lookahead = MyCfgGetInt("fcst","ahead",forecast_lookahead);
     forecast_lookbehind = MyCfgGetInt("fcst","behind",forecast_lookbehind);
-    weather_url = MyCfgGetString("weather","url",weather_url);
+    weather_url[0] = MyCfgGetString("weather","url",weather_url[0]);
+    for (int loc = 1; loc < max_locations; ++loc) {
+        weather_url[loc] = MyCfgGetString("weather","url" + String(loc),weather_url[loc]);
+    }
+    init_builtin_vars();
+    for (int i = builtin_vars; i < max_vars; ++i) {
+        String v = MyCfgGetString("fcstvar",String(i - builtin_vars),"");
+        if (loadVar(i, v) != NULL) {
+            LOGF(LOGM_TF, LOG_WARNING, "Ignoring bad fcstvar.%d: %s", i - builtin_vars, v.c_str());
+        }
+    }
 
 #ifdef ESP8266
     schedule_get_forecast(interval_sample * 60);
@@ -281,6 +410,13 @@ void TF_init() {
 #endif
 
     // register our config change handlers
-    MyCfgRegisterInt("fcst",&handleConfigInt);
-    MyCfgRegisterString("weather",&handleConfigUrl);
+    static constexpr MyCfgDesc config[] = {
+        { "fcst", &handleConfigInt },
+        { "weather", &handleConfigUrl },
+        { "fcstvar", &handleConfigVar },
+    };
+    MyCfgRegister(config);
+    MyCfgSubscribeInt("fcst.", &refetchInt);
+    MyCfgSubscribeString("weather.", &refetchString);
+    MyCfgSubscribeString("fcstvar.", &refetchString);
 }
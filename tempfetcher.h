@@ -1,4 +1,5 @@
 #pragma once
+#include <Arduino.h>
 #include <sys/time.h>
 
 // weather forecast
@@ -8,3 +9,7 @@ extern void TF_init();
 extern int forecast_low_temp;
 extern int historic_low_temp;
 extern time_t temp_fetch_time;
+
+// most recent value of a forecast variable by label (see fcstvar config)
+// "low" and "histlow" are always present, returns false if not yet known
+extern bool TF_get(const String & label, float & value);
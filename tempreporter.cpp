@@ -20,6 +20,13 @@
 #include <mysyslog.h>
 #include "myconfig.h"
 #include "tempreporter.h"
+#include <mytrace.h>
+#include <myboottime.h>
+#include <mytime.h>
+#ifndef ESP8266
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#endif
 
 #include <my_secrets.h>
 
@@ -29,6 +36,8 @@ Config nodes:
         trpin.[18b20|dht11] = number
         temprep.poll = seconds
         temprep.submit = seconds
+        temprep.sleep = seconds, deep sleep between samples (ESP32, 0 = off)
+        temprep.upload = number of sleep cycles between uploads
 */
 // how frequently we take readings
 #define INTERVAL_SAMPLE 5
@@ -36,6 +45,17 @@ int interval_sample = INTERVAL_SAMPLE;
 // how frequently we report readings
 #define INTERVAL_REPORT 60
 int interval_report = INTERVAL_REPORT;
+// deep sleep duty cycle, 0 when always on
+static int interval_sleep = 0;
+#define UPLOAD_CYCLES 10
+static int upload_cycles = UPLOAD_CYCLES;
+
+// sensor kinds as remembered across deep sleep
+enum trKind : uint8_t {
+    TRK_DS18B20,
+    TRK_DHT11_T,
+    TRK_DHT11_H,
+};
 
 //Your influx Domain name with URL path or IP address with path
 static const char* serverName = MY_INFLUX_DB;
@@ -60,6 +80,8 @@ class mysensor {
         void setName(const String & s) { str = s; }
         void setEnable(bool e) { enable = e; }
         bool getEnable() const { return enable; }
+        // describe the hardware so it can be recreated without a bus scan
+        virtual bool getKind(trKind & kind, uint8_t * addr) const { return false; }
     protected:
         float lastReading;
         void setAddr(const char *a) {
@@ -97,13 +119,18 @@ class mysensor_ds18b20 : public mysensor {
             bus->requestTemperaturesByAddress(da);
             lastReading = bus->getTempC(da);
         };
+        virtual bool getKind(trKind & kind, uint8_t * addr) const {
+            kind = TRK_DS18B20;
+            memcpy(addr, da, sizeof(DeviceAddress));
+            return true;
+        }
     private:
         DeviceAddress da;
         DallasTemperature * bus;
 };
 class mysensor_dht11_temp : public mysensor {
     public:
-        mysensor_dht11_temp(int pin, myDHT11_t * d) : dht11(d) {
+        mysensor_dht11_temp(int pin, myDHT11_t * d) : dht11(d), pin(pin) {
             char a[20];
             sprintf(a,"dht11.t.%d",pin);
             setAddr(a);
@@ -113,13 +140,19 @@ class mysensor_dht11_temp : public mysensor {
             lastReading = dht11->readTemperature();
             if (isnan(lastReading)) { lastReading = 999; }
         };
+        virtual bool getKind(trKind & kind, uint8_t * addr) const {
+            kind = TRK_DHT11_T;
+            addr[0] = pin;
+            return true;
+        }
         virtual ~mysensor_dht11_temp() {}
     private:
         myDHT11_t * dht11;
+        int pin;
 };
 class mysensor_dht11_humidity : public mysensor {
     public:
-        mysensor_dht11_humidity(int pin, myDHT11_t * d) : dht11(d), mysensor("humidity") {
+        mysensor_dht11_humidity(int pin, myDHT11_t * d) : mysensor("humidity"), dht11(d), pin(pin) {
             char a[20];
             sprintf(a,"dht11.h.%d",pin);
             setAddr(a);
@@ -129,9 +162,15 @@ class mysensor_dht11_humidity : public mysensor {
             lastReading = dht11->readHumidity();
             if (isnan(lastReading)) { lastReading = 999; }
         };
+        virtual bool getKind(trKind & kind, uint8_t * addr) const {
+            kind = TRK_DHT11_H;
+            addr[0] = pin;
+            return true;
+        }
         virtual ~mysensor_dht11_humidity() {}
     private:
         myDHT11_t * dht11;
+        int pin;
 };
 
 // fake sensor has no address just a name and value
@@ -160,6 +199,17 @@ static mysensor * sensorAddrs[max_sensors];
 // Number of real temperature devices found
 static int numberOfDevices = 0;
 
+#ifndef ESP8266
+// remaps and sensor names are changed from the config flush and the web
+// server while the TR task reads them
+static SemaphoreHandle_t tr_mutex = NULL;
+#define TR_LOCK() if (tr_mutex) { xSemaphoreTake(tr_mutex, portMAX_DELAY); }
+#define TR_UNLOCK() if (tr_mutex) { xSemaphoreGive(tr_mutex); }
+#else
+#define TR_LOCK()
+#define TR_UNLOCK()
+#endif
+
 static const char index_html[] PROGMEM = R"rawliteral(
 <!DOCTYPE HTML><html>
 <head>
@@ -224,7 +274,7 @@ static void add_sensor(mysensor * s, bool isColdBoot) {
     sprintf(msgbuf,"Device %d address %s %s", numberOfDevices, s->getAddr().c_str(),s->getName().c_str());
     Serial.println(msgbuf);
     if (isColdBoot) {
-        syslogf(msgbuf);
+        LOGF(LOGM_TR, LOG_INFO, "%s", msgbuf);
     }
     ++numberOfDevices;
     // set the enable flag
@@ -234,14 +284,45 @@ static void add_sensor(mysensor * s, bool isColdBoot) {
     s->setEnable(true);
 }
 
+static void tr_rtc_save();
+
 static const char * handleInterval(const char * name, const String & id, int &value) {
     if (id == "poll") {
         // all ok, save the value
-        interval_sample = value;
+        if (!MyCfgChecking()) {
+            interval_sample = value;
+        }
         return NULL;
     } else if (id == "submit") {
         // all ok, save the value
-        interval_report = value;
+        if (!MyCfgChecking()) {
+            interval_report = value;
+        }
+        return NULL;
+    } else if (id == "sleep") {
+#ifdef ESP8266
+        return "deep sleep not supported";
+#else
+        if (!MyCfgChecking()) {
+            // the TR task goes to sleep after its next upload, not here, the
+            // value has not been stored yet
+            interval_sleep = value;
+            TR_LOCK();
+            tr_rtc_save();
+            TR_UNLOCK();
+        }
+        return NULL;
+#endif
+    } else if (id == "upload") {
+        if (value < 1) {
+            return "upload must be at least 1";
+        }
+        if (!MyCfgChecking()) {
+            upload_cycles = value;
+            TR_LOCK();
+            tr_rtc_save();
+            TR_UNLOCK();
+        }
         return NULL;
     } else {
         return "interval type not recognised";
@@ -300,18 +381,29 @@ static void loadRemap(String & value) {
     }
 }
 
-// read and process all configured remaps
+// configured remaps, kept up to date by subscription
+static String remaps[max_sensors];
+
+// process all configured remaps
 static void loadRemaps() {
     int i;
-    String v;
-    String empty;
+    TR_LOCK();
     for(i=0; i<max_sensors; ++i) {
-        v = MyCfgGetString("trremap",String(i),empty);
-        if (!v.isEmpty()) {
-            syslogf("Loading remap %d containing: %s",i,v);
-            loadRemap(v);
+        if (!remaps[i].isEmpty()) {
+            LOGF(LOGM_TR, LOG_DEBUG, "Loading remap %d containing: %s",i,remaps[i].c_str());
+            loadRemap(remaps[i]);
         }
     }
+    TR_UNLOCK();
+}
+
+static void remapChanged(const char * name, const String & id, const String & value) {
+    int i = id.toInt();
+    if ((i >= 0) && (i < max_sensors)) {
+        TR_LOCK();
+        remaps[i] = value;
+        TR_UNLOCK();
+    }
 }
 
 // id is an arbitrary integer
@@ -329,7 +421,12 @@ static const char * handleConfigRemap(const char * name, const String & id, Stri
     if ((i+1) == value.length()) {
         return "sensor name not present";
     }
-    loadRemap(value);
+    if (!MyCfgChecking()) {
+        TR_LOCK();
+        loadRemap(value);
+        tr_rtc_save();
+        TR_UNLOCK();
+    }
     return NULL;
 }
 
@@ -337,6 +434,53 @@ static void serve_root_get(AsyncWebServerRequest *request) {
     request->send_P(200, "text/html", index_html, processor);
 }
 
+// names come from the remap config, escape them as the log tail does
+static void json_append(String & x, const String & v) {
+    for (const char * p = v.c_str(); *p; ++p) {
+        if ((*p == '"') || (*p == '\\')) {
+            x += '\\';
+            x += *p;
+        } else if ((uint8_t)*p < ' ') {
+            x += ' ';
+        } else {
+            x += *p;
+        }
+    }
+}
+
+// the same data as the root page as json, for static pages to render
+static void serve_sensors_json(AsyncWebServerRequest * request) {
+    String x;
+    char b[40];
+    x.reserve(64 + numberOfDevices * 64);
+    x += "{\"time\":";
+    x += String(time(NULL));
+    x += ",\"refresh\":";
+    x += String(interval_sample);
+    x += ",\"sensors\":[";
+    bool first = true;
+    // a remap may rename a sensor under us
+    TR_LOCK();
+    for(int i=0;i<max_sensors; i++){
+        if (sensorAddrs[i] == NULL) {
+            continue;
+        }
+        x += first ? "{\"name\":\"" : ",{\"name\":\"";
+        first = false;
+        json_append(x, sensorAddrs[i]->getName());
+        x += "\",\"addr\":\"";
+        json_append(x, sensorAddrs[i]->getAddr());
+        snprintf(b, sizeof(b), "\",\"type\":\"%s\",\"value\":%.2f}", sensorAddrs[i]->getType(), sensorAddrs[i]->getReading());
+        x += b;
+    }
+    TR_UNLOCK();
+    x += "]}";
+    AsyncWebServerResponse *response = request->beginResponse(200, "application/json", x);
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("Connection", "close");
+    request->send(response);
+}
+
 static void serve_sensor_get(AsyncWebServerRequest * request) {
     String x;
     AsyncWebServerResponse *response = nullptr;
@@ -432,7 +576,7 @@ static void scan_onewire(bool isColdBoot) {
     sprintf(msgbuf,"Started with %d devices",n);
     Serial.println(msgbuf);
     if (isColdBoot) {
-        syslogf(msgbuf);
+        LOGF(LOGM_TR, LOG_INFO, "%s", msgbuf);
     }
 
     // Loop through each device, print out address
@@ -444,21 +588,250 @@ static void scan_onewire(bool isColdBoot) {
         } else {
             sprintf(msgbuf,"Ghost device at %d", i);
             Serial.println(msgbuf);
-            syslogf(msgbuf);
+            LOGF(LOGM_TR, LOG_WARNING, "%s", msgbuf);
         }
     }
 }
 
 
 static time_t next_report = 0;
+#ifndef ESP8266
+// deep sleep duty cycle
+// the sensor registry and a batch of readings live in RTC memory, so a
+// wake only samples and sleeps again, every upload_cycles wakes the
+// network comes up and the batch is sent with the current readings
+#define TR_RTC_MAGIC 0x7e3b5a03
+#define TR_BATCH 128
+// give up on the network after this long awake
+#define TR_WAKE_TIMEOUT 60000
+
+struct trRtcSensor {
+    trKind kind;
+    uint8_t enable;
+    uint8_t addr[8];
+    char name[24];
+};
+struct trRtcReading {
+    // seconds since boot when provisional
+    uint32_t when;
+    uint8_t sensor;
+    uint8_t provisional;
+    float value;
+};
+struct trRtcState {
+    uint32_t magic;
+    int32_t sleep;
+    int32_t upload;
+    int8_t pin_18b20;
+    // the clock was set when we went to sleep, and the RTC keeps it
+    uint8_t clock_ok;
+    uint8_t nsensors;
+    trRtcSensor sensors[max_sensors];
+    uint16_t cycles;
+    uint16_t nreadings;
+    trRtcReading readings[TR_BATCH];
+};
+RTC_DATA_ATTR static trRtcState tr_rtc;
+// woken to upload, sensors come from RTC memory
+static bool duty_wake = false;
+
+// remember the sensors found by a full init
+static void tr_rtc_save() {
+    if (tr_rtc.magic != TR_RTC_MAGIC) {
+        tr_rtc.cycles = 0;
+        tr_rtc.nreadings = 0;
+        tr_rtc.clock_ok = 0;
+    }
+    tr_rtc.sleep = interval_sleep;
+    tr_rtc.upload = upload_cycles;
+    tr_rtc.pin_18b20 = MyCfgGetInt("trpin","18b20",-1);
+    tr_rtc.nsensors = 0;
+    for (int i = 0; i < numberOfDevices; ++i) {
+        trRtcSensor & r = tr_rtc.sensors[tr_rtc.nsensors];
+        if (!sensorAddrs[i]->getKind(r.kind, r.addr)) {
+            continue;
+        }
+        r.enable = sensorAddrs[i]->getEnable() &&
+                   (sensorAddrs[i]->getAddr() != sensorAddrs[i]->getName());
+        strncpy(r.name, sensorAddrs[i]->getName().c_str(), sizeof(r.name) - 1);
+        r.name[sizeof(r.name) - 1] = 0;
+        ++tr_rtc.nsensors;
+    }
+    tr_rtc.magic = TR_RTC_MAGIC;
+}
+
+// recreate the sensors without touching the bus or the config
+static void tr_rtc_restore() {
+    if (tr_rtc.pin_18b20 >= 0) {
+        // no begin(), that would search the bus
+        sensors = new DallasTemperature(new OneWire(tr_rtc.pin_18b20));
+    }
+    for (int i = 0; i < tr_rtc.nsensors; ++i) {
+        const trRtcSensor & r = tr_rtc.sensors[i];
+        mysensor * s = NULL;
+        switch (r.kind) {
+            case TRK_DS18B20:
+                if (sensors) {
+                    s = new mysensor_ds18b20(sensors, *(const DeviceAddress *)r.addr);
+                }
+                break;
+            case TRK_DHT11_T:
+            case TRK_DHT11_H:
+                if (dht11 == NULL) {
+#ifdef ADAFRUIT_DHT11
+                    dht11 = new DHT(r.addr[0], DHT11);
+                    dht11->begin();
+#else
+                    dht11 = new DHT11(r.addr[0]);
+#endif
+                }
+                if (r.kind == TRK_DHT11_T) {
+                    s = new mysensor_dht11_temp(r.addr[0], dht11);
+                } else {
+                    s = new mysensor_dht11_humidity(r.addr[0], dht11);
+                }
+                break;
+        }
+        if (s == NULL) {
+            continue;
+        }
+        // keep indexes in step with the registry
+        sensorAddrs[numberOfDevices++] = s;
+        s->setName(r.name);
+        s->setEnable(r.enable);
+    }
+}
+
+// add the latest readings to the batch
+// until the clock can be trusted they are stamped with the uptime and
+// given a real time when they are sent
+static void tr_batch_add(bool provisional) {
+    uint32_t when = provisional ? TIME_uptime() : (uint32_t)time(NULL);
+    for (int i = 0; (i < numberOfDevices) && (i < tr_rtc.nsensors); ++i) {
+        if (!tr_rtc.sensors[i].enable || (tr_rtc.nreadings >= TR_BATCH)) {
+            continue;
+        }
+        trRtcReading & r = tr_rtc.readings[tr_rtc.nreadings++];
+        r.when = when;
+        r.sensor = i;
+        r.provisional = provisional;
+        r.value = sensorAddrs[i]->getReading();
+    }
+}
+
+// time(NULL) can be used to stamp readings
+// early in a wake TIME_quality() does not know yet that the clock survived
+static bool tr_clock_ok() {
+    return (duty_wake && tr_rtc.clock_ok) || (TIME_quality() >= TIME_RTC);
+}
+
+// take a reading from every sensor into the batch
+static void tr_rtc_sample() {
+    if (!tr_clock_ok()) {
+        // uptime stamps would not survive the sleep, nothing to date them by
+        return;
+    }
+    for (int i = 0; i < numberOfDevices; ++i) {
+        sensorAddrs[i]->updateReading();
+    }
+    tr_batch_add(false);
+}
+
+// uptime stamps mean nothing after a reset, give the provisional
+// readings a real time if the clock can now be trusted or drop them
+static void tr_batch_settle() {
+    bool trusted = (TIME_quality() >= TIME_RTC);
+    int n = 0;
+    for (int i = 0; i < tr_rtc.nreadings; ++i) {
+        trRtcReading & r = tr_rtc.readings[i];
+        if (r.provisional) {
+            if (!trusted) {
+                continue;
+            }
+            r.when = TIME_from_uptime(r.when);
+            r.provisional = false;
+        }
+        tr_rtc.readings[n++] = r;
+    }
+    tr_rtc.nreadings = n;
+}
+
+// sleep for what is left of this cycle, does not return
+static void tr_sleep() {
+    tr_batch_settle();
+    tr_rtc.clock_ok = tr_clock_ok();
+    int64_t us = (int64_t)tr_rtc.sleep * 1000000 - esp_timer_get_time();
+    if (us < 1000000) {
+        us = 1000000;
+    }
+    esp_deep_sleep(us);
+}
+
+void TR_duty_cycle() {
+    if ((esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) ||
+        (tr_rtc.magic != TR_RTC_MAGIC) || (tr_rtc.sleep <= 0)) {
+        // a normal boot, do the full init
+        return;
+    }
+    duty_wake = true;
+    if ((++tr_rtc.cycles < tr_rtc.upload) &&
+        (tr_rtc.nreadings + tr_rtc.nsensors <= TR_BATCH)) {
+        tr_rtc_restore();
+        tr_rtc_sample();
+        tr_sleep();
+    }
+    // time to upload, carry on with the usual setup
+}
+
+// space needed for the batched readings
+static size_t tr_rtc_batch_size() {
+    return (tr_rtc.magic == TR_RTC_MAGIC) ? tr_rtc.nreadings * 80 : 0;
+}
+
+// append the batched readings as influx lines
+static char * tr_rtc_batch(char * buf, const char * end) {
+    if (tr_rtc.magic != TR_RTC_MAGIC) {
+        return buf;
+    }
+    for (int i = 0; i < tr_rtc.nreadings; ++i) {
+        const trRtcReading & r = tr_rtc.readings[i];
+        if (r.sensor >= numberOfDevices) {
+            continue;
+        }
+        time_t when = r.provisional ? TIME_from_uptime(r.when) : r.when;
+        buf += snprintf(buf, end - buf, "%s,t=%s value=%f %lu000000000\n", sensorAddrs[r.sensor]->getType(),
+                        tr_rtc.sensors[r.sensor].name, r.value, (unsigned long)when);
+    }
+    return buf;
+}
+#else
+static void tr_rtc_save() {}
+void TR_duty_cycle() {}
+#endif
+
 time_t TR_report_data(void)
 {
     time_t now = time(NULL);
 
+#ifndef ESP8266
+    if (duty_wake && (millis() > TR_WAKE_TIMEOUT)) {
+        // no network this time, keep the readings for the next upload
+        LOGF(LOGM_TR, LOG_NOTICE, "Upload wake timed out, sleeping");
+        tr_rtc_sample();
+        tr_sleep();
+    }
+#endif
+
+#ifdef ESP8266
     // wait for time to be known
     if (now < 1000000000) {
         return now+1;
     }
+#else
+    // sample straight away, readings wait in the batch until NTP or the
+    // RTC gives a time we can post them with
+    bool provisional = !tr_clock_ok();
+#endif
 
     // no point continuing if there are no devices connected
     if (numberOfDevices == 0) {
@@ -470,19 +843,47 @@ time_t TR_report_data(void)
     }
 
     // Loop through each real device, record temperature data
+    TRACE_BEGIN(TRACE_TR_SENSORS);
     for(int i=0;i<numberOfDevices; i++){
         sensorAddrs[i]->updateReading();
     }
+    TRACE_END(TRACE_TR_SENSORS);
 
-    if (next_report == 0 || now >= next_report) {
+    if (duty_wake || next_report == 0 || now >= next_report) {
+#ifndef ESP8266
+        if (provisional) {
+            // one set per upload wake, the batch from before the sleep is
+            // already waiting and more copies of now add nothing
+            static bool wake_added = false;
+            if (!duty_wake || !wake_added) {
+                wake_added = true;
+                tr_batch_add(true);
+            }
+            // the clock may step when it is set, so keep this relative
+            next_report = now + interval_report;
+            return now + ((interval_sample < 1) ? interval_report : interval_sample);
+        }
+#endif
         //Check WiFi connection status
         if (WiFi.status()!= WL_CONNECTED) {
             Serial.println("Wifi not connected!");
             return now+1;
         }
 
-        char post_data[80 * numberOfDevices];
+        // room for the wifi statistics line and any batched readings too
+        size_t post_len = 80 * numberOfDevices + 200;
+#ifndef ESP8266
+        post_len += tr_rtc_batch_size();
+#endif
+        char * post_data = (char *)malloc(post_len);
+        if (post_data == NULL) {
+            return now+1;
+        }
         char * buf = post_data;
+#ifndef ESP8266
+        buf = tr_rtc_batch(buf, post_data + post_len);
+#endif
+        TR_LOCK();
         for(int i=0;i<numberOfDevices; i++){
             // only submit if name has been provided
             if ((sensorAddrs[i]->getEnable()) &&
@@ -490,6 +891,7 @@ time_t TR_report_data(void)
                 buf += sprintf(buf, "%s,t=%s value=%f %ld000000000\n", sensorAddrs[i]->getType(), sensorAddrs[i]->getName().c_str(),sensorAddrs[i]->getReading(),now); 
             }
         }
+        TR_UNLOCK();
         // time to report temperatures
         if (next_report == 0) {
             next_report = now;
@@ -498,6 +900,8 @@ time_t TR_report_data(void)
         
         // only submit if there are readings to submit
         if (buf != post_data) {
+            buf += WIFI_influx(buf, post_data + post_len - buf, now);
+            TRACE_SCOPE(TRACE_TR_POST);
             WiFiClient client;
             HTTPClient http;
 
@@ -508,9 +912,32 @@ time_t TR_report_data(void)
             http.addHeader("Authorization", authtoken);
             // Send HTTP POST request
             int httpResponseCode = http.POST(post_data);
+            static bool first_sample = true;
+            if (first_sample && (httpResponseCode > 0)) {
+                first_sample = false;
+                BOOT_mark("tr.first");
+            }
             // Free resources
             http.end();
+#ifndef ESP8266
+            if ((httpResponseCode >= 200) && (httpResponseCode < 300)) {
+                // batch delivered
+                tr_rtc.nreadings = 0;
+            }
+#endif
+        }
+        free(post_data);
+#ifndef ESP8266
+        // also after the first upload of a normal boot, or once sleep has
+        // been turned on at runtime
+        if (duty_wake || (interval_sleep > 0)) {
+            // job done, back to sleep
+            tr_rtc.cycles = 0;
+            MyCfgFlush();
+            WIFI_going_for_reboot();
+            tr_sleep();
         }
+#endif
     }
 
     // report time to next sample
@@ -539,17 +966,44 @@ static void TR_reporting_task(void *)
 
 void TR_init(AsyncWebServer & server, bool run_in_loop, bool isColdBoot){
     int pin = -1;
+#ifndef ESP8266
+    tr_mutex = xSemaphoreCreateMutex();
+#endif
 
     interval_sample = MyCfgGetInt("temprep","poll",INTERVAL_SAMPLE);
     interval_report = MyCfgGetInt("temprep","submit",INTERVAL_REPORT);
+#ifndef ESP8266
+    interval_sleep = MyCfgGetInt("temprep","sleep",0);
+#endif
+    upload_cycles = MyCfgGetInt("temprep","upload",UPLOAD_CYCLES);
+    if (upload_cycles < 1) {
+        upload_cycles = 1;
+    }
 
+#ifndef ESP8266
+    if (duty_wake) {
+        // sensors were found before we went to sleep
+        tr_rtc_restore();
+        pin = -1;
+    } else {
+        pin = MyCfgGetInt("trpin","18b20",-1);
+    }
+#else
     pin = MyCfgGetInt("trpin","18b20",-1);
+#endif
     if (pin != -1) {
         sensors = new DallasTemperature(new OneWire(pin));
+        int boot_phase = BOOT_begin("onewire");
         scan_onewire(isColdBoot);
+        BOOT_end(boot_phase);
     }
 
     pin = MyCfgGetInt("trpin","dht11",-1);
+#ifndef ESP8266
+    if (duty_wake) {
+        pin = -1;
+    }
+#endif
     if (pin != -1) {
 #ifdef ADAFRUIT_DHT11
         dht11 = new DHT(pin, DHT11);
@@ -562,22 +1016,36 @@ void TR_init(AsyncWebServer & server, bool run_in_loop, bool isColdBoot){
     }
 
     if (numberOfDevices == 0) {
-        syslogf("No sensors found, are pins defined?");
+        LOGF(LOGM_TR, LOG_WARNING, "No sensors found, are pins defined?");
     }
     // only create readers once we are ready
 
     // read the name mappings from config
+    for(int i=0; i<max_sensors; ++i) {
+        remaps[i] = MyCfgGetString("trremap",String(i),"");
+    }
     loadRemaps();
+#ifndef ESP8266
+    if (!duty_wake) {
+        // remember what was found for the sleep cycles
+        tr_rtc_save();
+    }
+#endif
 
     // Route for root / web page
     server.on("/temperatures", HTTP_GET, serve_root_get);
+    server.on("/temperatures.json", HTTP_GET, serve_sensors_json);
     server.on("/api", HTTP_GET, serve_sensor_get);
     server.on("/fake", HTTP_GET, serve_sensor_fake);
 
     // register our config change handlers
-    MyCfgRegisterInt("trpin",&handleConfigPin);
-    MyCfgRegisterString("trremap",&handleConfigRemap);
-    MyCfgRegisterInt("temprep",&handleInterval);
+    static constexpr MyCfgDesc config[] = {
+        { "trpin", &handleConfigPin },
+        { "trremap", &handleConfigRemap },
+        { "temprep", &handleInterval },
+    };
+    MyCfgRegister(config);
+    MyCfgSubscribeString("trremap.", &remapChanged);
 
 #ifndef ESP8266
     // ESP8266 must always run in loop
@@ -3,3 +3,7 @@ extern void TR_init(AsyncWebServer & server, bool run_in_loop=false, bool isCold
 extern float TR_get(const String & name);
 // call this to report samples, do not call before return value
 time_t TR_report_data();
+// call early in setup() when temprep.sleep is in use
+// a timer wake between uploads samples the sensors and goes straight
+// back to deep sleep without returning
+extern void TR_duty_cycle();
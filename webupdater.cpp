@@ -1,10 +1,25 @@
 #include <Arduino.h>
 #ifndef ESP8266
 #include <Update.h>
+#if __has_include(<rom/miniz.h>)
+#include <rom/miniz.h>
+#else
+#include <esp32/rom/miniz.h>
+#endif
+#include <mbedtls/sha256.h>
 #endif
 #include <mywebserver.h>
 #include <mysyslog.h>
 #include <mywifi.h>
+#include <myconfig.h>
+#include <mygzip.h>
+
+// gzip compressed images are accepted, ESP8266 passes them to the updater
+// which handles them itself, ESP32 inflates them on the way to flash
+// with the ROM inflater
+// the sha256 of the image as written to flash can be given as a sha256
+// form field or query parameter, or an X-SHA256 header, a mismatch
+// aborts the update
 
 #ifdef ESP8266
 #define UPDATE_ERROR Update.getErrorString()
@@ -20,7 +35,12 @@ static void serve_update_page(AsyncWebServerRequest *request, const String & msg
         m+=msg;
         m+="</p>";
     }
-    m+="<form method='POST' action='update' enctype='multipart/form-data'><input type='file' name='update'><input type='submit' value='Update'></form><p/><p><a href=\"reboot\">Reboot</a></p><p>Build date: ";
+    m+="<form method='POST' action='update' enctype='multipart/form-data'>";
+#ifndef ESP8266
+    // not checked on ESP8266, so not offered either
+    m+="SHA-256 (optional) <input type='text' name='sha256' size='64'><br>";
+#endif
+    m+="<input type='file' name='update'><input type='submit' value='Update'></form><p/><p><a href=\"reboot\">Reboot</a></p><p>Build date: ";
     m+=build_time;
     m+="</p></body></html>";
     AsyncWebServerResponse *response = request->beginResponse(200, "text/html", m);
@@ -34,46 +54,263 @@ static void serve_update_get(AsyncWebServerRequest *request) {
     serve_update_page(request,"");
 }
 
+#ifndef ESP8266
+struct otaInflate {
+    tinfl_decompressor inflator;
+    // doubles as the deflate window
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+    size_t dict_ofs;
+    bool done;
+    // crc32 and length of the uncompressed data
+    uint8_t trailer[8];
+    size_t trailer_len;
+};
+static otaInflate * ota_gz = NULL;
+static mbedtls_sha256_context ota_sha;
+static uint32_t ota_crc;
+static size_t ota_size;
+#endif
+// why we gave up, reported in place of the updater error
+static String ota_error;
+// an upload is between its first and final chunk
+static bool ota_active = false;
+
+#ifndef ESP8266
+static void ota_fail(const char * why) {
+    if (ota_error.isEmpty()) {
+        ota_error = why;
+        LOGF(LOGM_OTA, LOG_ERR, "Update failed: %s", why);
+    }
+    Update.abort();
+}
+
+static void ota_cleanup() {
+    if (ota_gz) {
+        free(ota_gz);
+        ota_gz = NULL;
+    }
+    mbedtls_sha256_free(&ota_sha);
+}
+
+// length of the gzip header, 0 if it is not one we can inflate
+static size_t gz_header_len(const uint8_t * d, size_t len) {
+    if ((len < 10) || (d[0] != 0x1f) || (d[1] != 0x8b) || (d[2] != 8)) {
+        return 0;
+    }
+    uint8_t flags = d[3];
+    size_t n = 10;
+    if (flags & 4) {
+        // FEXTRA
+        if (n + 2 > len) { return 0; }
+        n += 2 + (d[n] | (d[n + 1] << 8));
+    }
+    for (uint8_t f = 8; f <= 16; f <<= 1) {
+        // FNAME and FCOMMENT are nul terminated
+        if (flags & f) {
+            while ((n < len) && d[n]) { ++n; }
+            ++n;
+        }
+    }
+    if (flags & 2) {
+        // FHCRC
+        n += 2;
+    }
+    return (n <= len) ? n : 0;
+}
+
+static bool ota_write(uint8_t * data, size_t len) {
+    if (Update.write(data, len) != len) {
+        return false;
+    }
+    mbedtls_sha256_update(&ota_sha, data, len);
+    ota_crc = GZ_crc32(ota_crc, data, len);
+    ota_size += len;
+    return true;
+}
+
+// inflate a chunk into flash, whatever follows the deflate data is
+// kept as the gzip trailer
+static bool ota_inflate(const uint8_t * in, size_t len, bool final) {
+    while (!ota_gz->done) {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - ota_gz->dict_ofs;
+        tinfl_status st = tinfl_decompress(&ota_gz->inflator, in, &in_bytes,
+                                           ota_gz->dict, ota_gz->dict + ota_gz->dict_ofs, &out_bytes,
+                                           final ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+        in += in_bytes;
+        len -= in_bytes;
+        if (out_bytes && !ota_write(ota_gz->dict + ota_gz->dict_ofs, out_bytes)) {
+            return false;
+        }
+        ota_gz->dict_ofs = (ota_gz->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        if (st == TINFL_STATUS_DONE) {
+            ota_gz->done = true;
+        } else if (st < 0) {
+            ota_fail("corrupt gzip data");
+            return false;
+        } else if (st == TINFL_STATUS_NEEDS_MORE_INPUT) {
+            return true;
+        }
+    }
+    while (len && (ota_gz->trailer_len < sizeof(ota_gz->trailer))) {
+        ota_gz->trailer[ota_gz->trailer_len++] = *in++;
+        --len;
+    }
+    return true;
+}
+
+static uint32_t get_le32(const uint8_t * p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// the expected hash, from a header, the query or the form
+static String ota_expected_sha(AsyncWebServerRequest * request) {
+    String x;
+    if (request->hasHeader("X-SHA256")) {
+        x = request->getHeader("X-SHA256")->value();
+    } else if (request->hasParam("sha256", true)) {
+        x = request->getParam("sha256", true)->value();
+    } else if (request->hasParam("sha256")) {
+        x = request->getParam("sha256")->value();
+    }
+    x.trim();
+    x.toLowerCase();
+    return x;
+}
+
+// check the trailer and hash once everything is written
+static bool ota_verify(AsyncWebServerRequest * request) {
+    if (ota_gz) {
+        if (!ota_gz->done || (ota_gz->trailer_len < sizeof(ota_gz->trailer))) {
+            ota_fail("truncated gzip image");
+            return false;
+        }
+        if ((get_le32(ota_gz->trailer) != ota_crc) || (get_le32(ota_gz->trailer + 4) != (uint32_t)ota_size)) {
+            ota_fail("gzip crc or length mismatch");
+            return false;
+        }
+    }
+    uint8_t sha[32];
+    char hex[65];
+    mbedtls_sha256_finish(&ota_sha, sha);
+    for (int i = 0; i < 32; ++i) {
+        sprintf(hex + i * 2, "%02x", sha[i]);
+    }
+    String expected = ota_expected_sha(request);
+    if (!expected.isEmpty() && (expected != hex)) {
+        ota_fail("sha256 mismatch");
+        return false;
+    }
+    LOGF(LOGM_OTA, LOG_INFO, "Update image %u bytes sha256 %s%s", (unsigned)ota_size, hex,
+         expected.isEmpty() ? " (not checked)" : "");
+    return true;
+}
+#endif
+
 static void serve_update_post(AsyncWebServerRequest *request){
     String m="Update completed ";
-    if (!Update.hasError()) {
+    if (!ota_error.isEmpty()) {
+        m+="badly: ";
+        m+=ota_error;
+    } else if (!Update.hasError()) {
         m+="OK";
     } else {
         m+="badly: ";
         m+=UPDATE_ERROR;
     }
-    syslogf(LOG_DAEMON|LOG_ERR,m.c_str());
+    LOGF(LOGM_OTA, LOG_ERR, "%s", m.c_str());
     serve_update_page(request, m, true);
 }
 
+// the client went away mid upload, final will never come
+static void ota_disconnected() {
+    if (!ota_active) {
+        return;
+    }
+    ota_active = false;
+    LOGF(LOGM_OTA, LOG_ERR, "Update failed: client disconnected");
+#ifdef ESP8266
+    // ends with an error and resets the updater as the image is incomplete
+    Update.end(false);
+#else
+    ota_cleanup();
+    Update.abort();
+#endif
+}
+
 static void serve_update_post_body(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
     if(!index){
         Serial.printf("Update Start: %s\n", filename.c_str());
-        syslogf(LOG_DAEMON|LOG_INFO,"Update Start: %s", filename.c_str());
+        LOGF(LOGM_OTA, LOG_INFO, "Update Start: %s", filename.c_str());
+        ota_error = "";
+        ota_active = true;
+        request->onDisconnect(ota_disconnected);
 #ifdef ESP8266
         Update.runAsync(true);
         if(!Update.begin(ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000)
 #else
+        ota_cleanup();
+        mbedtls_sha256_init(&ota_sha);
+        mbedtls_sha256_starts(&ota_sha, 0);
+        ota_crc = 0;
+        ota_size = 0;
+        size_t hdr = gz_header_len(data, len);
+        if (hdr) {
+            ota_gz = (otaInflate *)malloc(sizeof(otaInflate));
+            if (ota_gz == NULL) {
+                ota_fail("no memory to inflate");
+            } else {
+                tinfl_init(&ota_gz->inflator);
+                ota_gz->dict_ofs = 0;
+                ota_gz->done = false;
+                ota_gz->trailer_len = 0;
+                data += hdr;
+                len -= hdr;
+            }
+        }
         if(!Update.begin())
 #endif
         {
             Update.printError(Serial);
-            syslogf(LOG_DAEMON|LOG_INFO,"Update failed: %s",UPDATE_ERROR);
+            LOGF(LOGM_OTA, LOG_ERR, "Update failed: %s",UPDATE_ERROR);
         }
     }
+#ifdef ESP8266
     if(!Update.hasError()){
         if(Update.write(data, len) != len){
             Update.printError(Serial);
-            syslogf(LOG_DAEMON|LOG_INFO,"Update failed: %s",UPDATE_ERROR);
+            LOGF(LOGM_OTA, LOG_ERR, "Update failed: %s",UPDATE_ERROR);
         }
     }
+#else
+    if(!Update.hasError() && ota_error.isEmpty()){
+        bool ok = ota_gz ? ota_inflate(data, len, final) : ota_write(data, len);
+        if (!ok && ota_error.isEmpty()) {
+            Update.printError(Serial);
+            LOGF(LOGM_OTA, LOG_ERR, "Update failed: %s",UPDATE_ERROR);
+        }
+    }
+    if (final) {
+        if (!Update.hasError() && ota_error.isEmpty()) {
+            ota_verify(request);
+        }
+        ota_cleanup();
+        if (!ota_error.isEmpty()) {
+            // make sure the new image is never booted
+            ota_active = false;
+            Update.abort();
+            return;
+        }
+    }
+#endif
     if(final){
+        ota_active = false;
         if(Update.end(true)){
             Serial.printf("Update Success: %uB\n", index+len);
-            syslogf(LOG_DAEMON|LOG_INFO,"Update success");
+            LOGF(LOGM_OTA, LOG_INFO, "Update success");
         } else {
             Update.printError(Serial);
-            syslogf(LOG_DAEMON|LOG_INFO,"Update failed: %s",UPDATE_ERROR);
+            LOGF(LOGM_OTA, LOG_ERR, "Update failed: %s",UPDATE_ERROR);
         }
     }
 }
@@ -83,8 +320,9 @@ static void serve_reboot_get(AsyncWebServerRequest *request) {
     response->addHeader("Connection", "close");
     // TODO how to defer the restart until the response has been sent?
     request->send(response);
-    syslogf(LOG_DAEMON|LOG_CRIT,"Restarting");
+    LOGF(LOGM_OTA, LOG_CRIT, "Restarting");
     Serial.printf("Restarting");
+    MyCfgFlush();
     WIFI_going_for_reboot();
     delay(1000);
     ESP.restart();